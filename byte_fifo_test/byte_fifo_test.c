@@ -0,0 +1,360 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../serial_driver/byte_fifo.h"
+#include "mutex_fifo.h"
+
+#define FIFO_SIZE            256  // Same as the receive fifo of the driver
+#define MAX_CHUNK            64
+#define DEFAULT_STRESS_BYTES (64UL * 1024 * 1024)
+#define DEFAULT_BENCH_BYTES  (16UL * 1024 * 1024)
+
+// Both sides of the stress test draw the byte sequence and their chunk sizes from xorshift32
+static uint32_t next_random(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void fail(const char* what, unsigned long position, int got, int expected)
+{
+    printf("ERR - %s at byte %lu: got %d, expected %d\n", what, position, got, expected);
+    exit(EXIT_FAILURE);
+}
+
+static void usage(const char* name)
+{
+    printf("Usage: %s [-n bytes] [-b bytes] [-s seed]\n", name);
+    printf("  Checks the lock-free byte fifo of the driver, with one producer and one consumer thread,\n");
+    printf("  then compares its throughput with the mutex fifo it replaced\n");
+    printf("  -n bytes  bytes through the fifo in the stress test, default %lu\n", DEFAULT_STRESS_BYTES);
+    printf("  -b bytes  bytes through each fifo in the benchmark, default %lu, 0 to skip it\n", DEFAULT_BENCH_BYTES);
+    printf("  -s seed   seed of the byte sequence, default 1\n");
+}
+
+static void check_single_thread(void)
+{
+    unsigned char data[8];
+    unsigned char in[16];
+    unsigned char out[16];
+    struct byte_fifo_t fifo = {.data = data, .size = sizeof(data)};
+
+    for (int i = 0; i < (int)sizeof(in); i++)
+        in[i] = i;
+
+    struct byte_fifo_t odd = {.data = data, .size = 6};
+    if (byte_fifo_init(&odd) != -EINVAL)
+        fail("init accepted a size that is not a power of two", 0, 0, -EINVAL);
+    if (byte_fifo_init(&fifo) != 0)
+        fail("init", 0, -1, 0);
+
+    // Move the indexes half way so the next writes wrap around the end of the buffer
+    int result = byte_fifo_write(&fifo, in, 5);
+    if (result != 0)
+        fail("dropped bytes", 0, result, 0);
+    result = byte_fifo_read(&fifo, out, 3);
+    if (result != 3)
+        fail("read", 0, result, 3);
+
+    result = byte_fifo_write(&fifo, in + 5, 6);
+    if (result != 0)
+        fail("dropped bytes", 5, result, 0);
+    result = byte_fifo_count(&fifo);
+    if (result != 8)
+        fail("count", 11, result, 8);
+    result = byte_fifo_is_available(&fifo);
+    if (result != 0)
+        fail("full fifo reported available", 11, result, 0);
+
+    // A full fifo keeps its bytes and drops the new ones
+    result = byte_fifo_write(&fifo, in + 11, 2);
+    if (result != 2)
+        fail("dropped bytes", 11, result, 2);
+
+    for (int offset = 0; offset < 8; offset++)
+    {
+        result = byte_fifo_peek(&fifo, offset);
+        if (result != 3 + offset)
+            fail("peek", 3 + offset, result, 3 + offset);
+    }
+    result = byte_fifo_peek(&fifo, 8);
+    if (result != -ENODATA)
+        fail("peek past the end", 11, result, -ENODATA);
+
+    result = byte_fifo_read(&fifo, out, sizeof(out));
+    if (result != 8)
+        fail("read", 3, result, 8);
+    for (int i = 0; i < 8; i++)
+    {
+        if (out[i] != 3 + i)
+            fail("wrong byte", 3 + i, out[i], 3 + i);
+    }
+
+    byte_fifo_write(&fifo, in, 4);
+    byte_fifo_reset(&fifo);
+    result = byte_fifo_count(&fifo);
+    if (result != 0)
+        fail("count after reset", 0, result, 0);
+    result = byte_fifo_read(&fifo, out, sizeof(out));
+    if (result != 0)
+        fail("read after reset", 0, result, 0);
+
+    printf("single thread: ok\n");
+}
+
+struct stress_t
+{
+    struct byte_fifo_t fifo;
+    unsigned long n_bytes;
+    uint32_t seed;
+    unsigned long n_peeks;
+};
+
+// The producer never writes more than the free space, so nothing may be dropped
+static void* stress_producer(void* arg)
+{
+    struct stress_t* stress = arg;
+    uint32_t bytes = stress->seed;
+    uint32_t chunks = stress->seed ^ 0x9e3779b9;
+    unsigned char chunk[MAX_CHUNK];
+    unsigned long n_written = 0;
+
+    while (n_written < stress->n_bytes)
+    {
+        unsigned int n_free = FIFO_SIZE - byte_fifo_count(&stress->fifo);
+        unsigned int len = 1 + next_random(&chunks) % MAX_CHUNK;
+        if (len > n_free)
+            len = n_free;
+        if (len > stress->n_bytes - n_written)
+            len = stress->n_bytes - n_written;
+        if (0 == len)
+        {
+            sched_yield();
+            continue;
+        }
+
+        for (unsigned int i = 0; i < len; i++)
+            chunk[i] = next_random(&bytes);
+
+        int n_dropped = byte_fifo_write(&stress->fifo, chunk, len);
+        if (n_dropped != 0)
+            fail("dropped bytes", n_written, n_dropped, 0);
+        n_written += len;
+    }
+
+    return NULL;
+}
+
+static void* stress_consumer(void* arg)
+{
+    struct stress_t* stress = arg;
+    uint32_t bytes = stress->seed;
+    uint32_t chunks = stress->seed ^ 0x7f4a7c15;
+    unsigned char chunk[MAX_CHUNK];
+    unsigned long n_read = 0;
+
+    while (n_read < stress->n_bytes)
+    {
+        unsigned int len = 1 + next_random(&chunks) % MAX_CHUNK;
+
+        // Peek at the next byte from time to time, it is there once the producer published it
+        if (0 == (len & 7))
+        {
+            uint32_t ahead = bytes;
+            unsigned char expected = next_random(&ahead);
+            int first = byte_fifo_peek(&stress->fifo, 0);
+            if (first >= 0)
+            {
+                if (first != expected)
+                    fail("peek", n_read, first, expected);
+                stress->n_peeks++;
+            }
+        }
+
+        int result = byte_fifo_read(&stress->fifo, chunk, len);
+        if (result < 0 || (unsigned int)result > len)
+            fail("read", n_read, result, len);
+        if (0 == result)
+            sched_yield();
+
+        for (int i = 0; i < result; i++)
+        {
+            unsigned char expected = next_random(&bytes);
+            if (chunk[i] != expected)
+                fail("wrong byte", n_read + i, chunk[i], expected);
+        }
+        n_read += result;
+    }
+
+    int left = byte_fifo_count(&stress->fifo);
+    if (left != 0)
+        fail("bytes left over", n_read, left, 0);
+
+    return NULL;
+}
+
+static void check_two_threads(unsigned long n_bytes, uint32_t seed)
+{
+    static unsigned char data[FIFO_SIZE];
+    struct stress_t stress = {
+        .fifo = {.data = data, .size = sizeof(data)},
+        .n_bytes = n_bytes,
+        .seed = seed,
+    };
+    pthread_t producer, consumer;
+
+    byte_fifo_init(&stress.fifo);
+    if (pthread_create(&consumer, NULL, stress_consumer, &stress) != 0 ||
+        pthread_create(&producer, NULL, stress_producer, &stress) != 0)
+    {
+        printf("ERR - Could not start the threads\n");
+        exit(EXIT_FAILURE);
+    }
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+
+    printf("two threads: ok, %lu bytes in order, %lu peeks\n", n_bytes, stress.n_peeks);
+}
+
+// Fixed size chunks in both directions, the way the receive path moves bytes
+struct bench_t
+{
+    struct byte_fifo_t ring;
+    struct mutex_fifo_t locked;
+    bool use_ring;
+    unsigned long n_bytes;
+};
+
+static void* bench_producer(void* arg)
+{
+    struct bench_t* bench = arg;
+    unsigned char chunk[MAX_CHUNK];
+    unsigned long n_written = 0;
+
+    memset(chunk, 0x5a, sizeof(chunk));
+    while (n_written < bench->n_bytes)
+    {
+        int count = bench->use_ring ? byte_fifo_count(&bench->ring) : mutex_fifo_count(&bench->locked);
+        if (FIFO_SIZE - count < MAX_CHUNK)
+        {
+            sched_yield();
+            continue;
+        }
+        if (bench->use_ring)
+            byte_fifo_write(&bench->ring, chunk, MAX_CHUNK);
+        else
+            mutex_fifo_write(&bench->locked, chunk, MAX_CHUNK);
+        n_written += MAX_CHUNK;
+    }
+
+    return NULL;
+}
+
+static void* bench_consumer(void* arg)
+{
+    struct bench_t* bench = arg;
+    unsigned char chunk[MAX_CHUNK];
+    unsigned long n_read = 0;
+
+    while (n_read < bench->n_bytes)
+    {
+        int result = bench->use_ring ? byte_fifo_read(&bench->ring, chunk, MAX_CHUNK)
+                                     : mutex_fifo_read(&bench->locked, chunk, MAX_CHUNK);
+        if (0 == result)
+            sched_yield();
+        n_read += result;
+    }
+
+    return NULL;
+}
+
+static double bench_run(struct bench_t* bench)
+{
+    struct timespec start, end;
+    pthread_t producer, consumer;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_create(&consumer, NULL, bench_consumer, bench);
+    pthread_create(&producer, NULL, bench_producer, bench);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return bench->n_bytes / seconds / (1024 * 1024);
+}
+
+static void benchmark(unsigned long n_bytes)
+{
+    static unsigned char ring_data[FIFO_SIZE];
+    static unsigned char locked_data[FIFO_SIZE];
+    struct bench_t bench = {
+        .ring = {.data = ring_data, .size = sizeof(ring_data)},
+        .locked = {.data = locked_data, .size = sizeof(locked_data)},
+        .n_bytes = n_bytes - n_bytes % MAX_CHUNK,
+    };
+
+    byte_fifo_init(&bench.ring);
+    mutex_fifo_init(&bench.locked);
+
+    bench.use_ring = false;
+    double locked = bench_run(&bench);
+    bench.use_ring = true;
+    double ring = bench_run(&bench);
+
+    printf("benchmark: %lu bytes in %d byte chunks\n", bench.n_bytes, MAX_CHUNK);
+    printf("  mutex fifo     %10.1f MiB/s\n", locked);
+    printf("  lock-free ring %10.1f MiB/s (x%.1f)\n", ring, ring / locked);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long stress_bytes = DEFAULT_STRESS_BYTES;
+    unsigned long bench_bytes = DEFAULT_BENCH_BYTES;
+    uint32_t seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:s:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                stress_bytes = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                bench_bytes = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (0 == seed)
+    {
+        printf("ERR - The seed must not be zero\n");
+        exit(EXIT_FAILURE);
+    }
+
+    check_single_thread();
+    check_two_threads(stress_bytes, seed);
+    if (bench_bytes >= MAX_CHUNK)
+        benchmark(bench_bytes);
+
+    return EXIT_SUCCESS;
+}
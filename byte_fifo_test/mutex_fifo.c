@@ -0,0 +1,97 @@
+#include "mutex_fifo.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+#define RETURN_IF(x, y) \
+    if ((x)) return (y)
+
+int16_t mutex_fifo_init(struct mutex_fifo_t* const fifo)
+{
+    RETURN_IF(NULL == fifo, -EFAULT);
+    RETURN_IF(NULL == fifo->data, -EFAULT);
+
+    pthread_mutex_init(&fifo->lock, NULL);
+    fifo->write_index = 0U;
+    fifo->read_index = 0U;
+    fifo->n_elements = 0U;
+    memset((void*)fifo->data, 0, fifo->size);
+
+    return 0;
+}
+
+int16_t mutex_fifo_count(struct mutex_fifo_t* const fifo)
+{
+    RETURN_IF(NULL == fifo, -EFAULT);
+
+    pthread_mutex_lock(&fifo->lock);
+    int count = fifo->n_elements;
+    pthread_mutex_unlock(&fifo->lock);
+
+    return count;
+}
+
+// One byte per lock round trip, overwriting the oldest bytes when full
+int16_t mutex_fifo_write(struct mutex_fifo_t* const fifo, const unsigned char* const bytes, unsigned int len)
+{
+    RETURN_IF(NULL == fifo, -EFAULT);
+    RETURN_IF(NULL == fifo->data, -EFAULT);
+    RETURN_IF(NULL == bytes, -EFAULT);
+
+    int n_bytes_written = 0;
+    int n_bytes_overwritten = 0;
+    while (len > 0)
+    {
+        pthread_mutex_lock(&fifo->lock);
+        if (fifo->n_elements < fifo->size)
+        {
+            unsigned int write_index = fifo->write_index;
+            fifo->data[write_index] = bytes[n_bytes_written];
+            fifo->write_index = (write_index < (fifo->size - 1)) ? write_index + 1 : 0;
+            fifo->n_elements++;
+
+            n_bytes_written++;
+            len--;
+        }
+        else
+        {
+            unsigned int read_index = fifo->read_index;
+            fifo->read_index = (read_index < (fifo->size - 1)) ? read_index + 1 : 0;
+            fifo->n_elements--;
+            n_bytes_overwritten++;
+        }
+        pthread_mutex_unlock(&fifo->lock);
+    }
+
+    return n_bytes_overwritten;
+}
+
+int16_t mutex_fifo_read(struct mutex_fifo_t* const fifo, unsigned char* const buffer, unsigned int max_len)
+{
+    RETURN_IF(NULL == fifo, -EFAULT);
+    RETURN_IF(NULL == fifo->data, -EFAULT);
+    RETURN_IF(NULL == buffer, -EFAULT);
+
+    unsigned int n_bytes_read = 0;
+    while (n_bytes_read < max_len)
+    {
+        pthread_mutex_lock(&fifo->lock);
+        if (fifo->n_elements > 0)
+        {
+            unsigned int read_index = fifo->read_index;
+            buffer[n_bytes_read] = fifo->data[read_index];
+            fifo->read_index = (read_index < (fifo->size - 1)) ? read_index + 1 : 0;
+            fifo->n_elements--;
+            n_bytes_read++;
+            pthread_mutex_unlock(&fifo->lock);
+        }
+        else
+        {
+            pthread_mutex_unlock(&fifo->lock);
+            break;
+        }
+    }
+
+    return n_bytes_read;
+}
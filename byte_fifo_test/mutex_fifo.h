@@ -0,0 +1,24 @@
+#ifndef MUTEX_FIFO_H_
+#define MUTEX_FIFO_H_
+
+#include <pthread.h>
+#include <stdint.h>
+
+// The byte fifo of the driver before it became a lock-free ring, with a pthread mutex in place of
+// the kernel mutex. Only kept as the baseline of the benchmark.
+struct mutex_fifo_t
+{
+    unsigned char* data;
+    unsigned int size;
+    unsigned int write_index;
+    unsigned int read_index;
+    unsigned int n_elements;
+    pthread_mutex_t lock;
+};
+
+int16_t mutex_fifo_init(struct mutex_fifo_t* const fifo);
+int16_t mutex_fifo_count(struct mutex_fifo_t* const fifo);
+int16_t mutex_fifo_write(struct mutex_fifo_t* const fifo, const unsigned char* const bytes, unsigned int len);
+int16_t mutex_fifo_read(struct mutex_fifo_t* const fifo, unsigned char* const buffer, unsigned int max_len);
+
+#endif  // MUTEX_FIFO_H_
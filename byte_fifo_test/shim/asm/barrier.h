@@ -0,0 +1,9 @@
+#ifndef SHIM_ASM_BARRIER_H_
+#define SHIM_ASM_BARRIER_H_
+
+// Same ordering as the kernel primitives, from the C11 memory model
+#define smp_load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define smp_mb()                __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+#endif  // SHIM_ASM_BARRIER_H_
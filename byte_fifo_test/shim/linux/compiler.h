@@ -0,0 +1,7 @@
+#ifndef SHIM_LINUX_COMPILER_H_
+#define SHIM_LINUX_COMPILER_H_
+
+#define READ_ONCE(x)     __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define WRITE_ONCE(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELAXED)
+
+#endif  // SHIM_LINUX_COMPILER_H_
@@ -0,0 +1,11 @@
+#ifndef SHIM_LINUX_LOG2_H_
+#define SHIM_LINUX_LOG2_H_
+
+#include <stdbool.h>
+
+static inline bool is_power_of_2(unsigned long n)
+{
+    return (n != 0) && (0 == (n & (n - 1)));
+}
+
+#endif  // SHIM_LINUX_LOG2_H_
@@ -0,0 +1,11 @@
+#ifndef SHIM_LINUX_MINMAX_H_
+#define SHIM_LINUX_MINMAX_H_
+
+#define min(a, b)                  \
+    ({                             \
+        __typeof__(a) _a = (a);    \
+        __typeof__(b) _b = (b);    \
+        (_a < _b) ? _a : _b;       \
+    })
+
+#endif  // SHIM_LINUX_MINMAX_H_
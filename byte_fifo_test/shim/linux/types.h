@@ -0,0 +1,10 @@
+#ifndef SHIM_LINUX_TYPES_H_
+#define SHIM_LINUX_TYPES_H_
+
+// byte_fifo.c built in user space: the kernel types it uses come from the C library
+#include_next <linux/types.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#endif  // SHIM_LINUX_TYPES_H_
@@ -0,0 +1,183 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <time.h>
+#include <unistd.h>
+
+#include "../serial_driver/modbus_crc.h"
+#include "../serial_driver/nanomodbus.h"
+
+#define MAX_FRAME           256  // Longest RTU frame, CRC included
+#define MAX_SPLITS          8
+#define DEFAULT_FRAMES      1000000UL
+#define DEFAULT_BENCH_BYTES (64UL * 1024 * 1024)
+
+static uint32_t next_random(uint32_t* state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// nmbs_crc_calc() returns the CRC with its bytes swapped, ready to be put on the wire big-endian
+static uint16_t reference_crc(const uint8_t* data, uint32_t len)
+{
+    uint16_t crc = nmbs_crc_calc(data, len, NULL);
+    return (uint16_t)(crc << 8) | (uint16_t)(crc >> 8);
+}
+
+static void usage(const char* name)
+{
+    printf("Usage: %s [-n frames] [-b bytes] [-s seed]\n", name);
+    printf("  Compares the table driven CRC of the driver with the bitwise one of nanomodbus on random\n");
+    printf("  frames fed in random pieces, then times both\n");
+    printf("  -n frames  random frames to check, default %lu\n", DEFAULT_FRAMES);
+    printf("  -b bytes   bytes through each implementation in the benchmark, default %lu, 0 to skip it\n",
+           DEFAULT_BENCH_BYTES);
+    printf("  -s seed    seed of the frames, default 1\n");
+}
+
+static void check_random_frames(unsigned long n_frames, uint32_t seed)
+{
+    // Room in front of the frame to start it at any alignment
+    uint8_t buffer[MAX_FRAME + 4];
+    uint32_t state = seed;
+
+    for (unsigned long frame = 0; frame < n_frames; frame++)
+    {
+        uint8_t* data = buffer + next_random(&state) % 4;
+        const unsigned int len = next_random(&state) % (MAX_FRAME - 2 + 1);
+        for (unsigned int i = 0; i < len; i++)
+            data[i] = next_random(&state);
+
+        const uint16_t expected = reference_crc(data, len);
+
+        // Fold the frame in pieces, the way it arrives from the serial port
+        unsigned int splits[MAX_SPLITS + 1];
+        const unsigned int n_splits = next_random(&state) % (MAX_SPLITS + 1);
+        for (unsigned int i = 0; i < n_splits; i++)
+            splits[i] = (0 == len) ? 0 : next_random(&state) % (len + 1);
+        splits[n_splits] = len;
+
+        uint16_t crc = MODBUS_CRC_INIT;
+        unsigned int done = 0;
+        for (unsigned int i = 0; i <= n_splits; i++)
+        {
+            // Split points come unsorted, one behind the previous piece makes an empty piece
+            const unsigned int end = (splits[i] > done) ? splits[i] : done;
+            crc = modbus_crc_update(crc, data + done, end - done);
+            done = end;
+        }
+
+        if (crc != expected)
+        {
+            printf("ERR - Frame %lu of %u bytes in %u pieces: got 0x%04x, expected 0x%04x\n", frame, len,
+                   n_splits + 1, crc, expected);
+            exit(EXIT_FAILURE);
+        }
+
+        // A frame followed by its CRC, low byte first, folds to zero
+        data[len] = crc & 0xFF;
+        data[len + 1] = crc >> 8;
+        crc = modbus_crc_update(MODBUS_CRC_INIT, data, len + 2);
+        if (crc != 0)
+        {
+            printf("ERR - Frame %lu of %u bytes with its CRC: got 0x%04x, expected 0\n", frame, len, crc);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    printf("random frames: ok, %lu frames\n", n_frames);
+}
+
+static double elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+static void benchmark(unsigned long n_bytes, uint32_t seed)
+{
+    uint8_t frame[MAX_FRAME];
+    uint32_t state = seed;
+    const unsigned long n_frames = (n_bytes + MAX_FRAME - 1) / MAX_FRAME;
+    struct timespec start, end;
+    volatile uint16_t sink = 0;
+
+    for (unsigned int i = 0; i < MAX_FRAME; i++)
+        frame[i] = next_random(&state);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned long i = 0; i < n_frames; i++)
+    {
+        frame[0] = i;
+        sink = nmbs_crc_calc(frame, MAX_FRAME, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double bitwise_ns = elapsed_ns(&start, &end) / n_frames;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (unsigned long i = 0; i < n_frames; i++)
+    {
+        frame[0] = i;
+        sink = modbus_crc_update(MODBUS_CRC_INIT, frame, MAX_FRAME);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double table_ns = elapsed_ns(&start, &end) / n_frames;
+    (void)sink;
+
+    printf("benchmark: %lu frames of %d bytes\n", n_frames, MAX_FRAME);
+    printf("  bitwise (nanomodbus) %8.1f ns/frame %8.1f MiB/s\n", bitwise_ns,
+           MAX_FRAME / bitwise_ns * 1e9 / (1024 * 1024));
+    printf("  slice-by-4 (driver)  %8.1f ns/frame %8.1f MiB/s (x%.1f)\n", table_ns,
+           MAX_FRAME / table_ns * 1e9 / (1024 * 1024), bitwise_ns / table_ns);
+}
+
+int main(int argc, char** argv)
+{
+    unsigned long n_frames = DEFAULT_FRAMES;
+    unsigned long bench_bytes = DEFAULT_BENCH_BYTES;
+    uint32_t seed = 1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:b:s:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'n':
+                n_frames = strtoul(optarg, NULL, 0);
+                break;
+            case 'b':
+                bench_bytes = strtoul(optarg, NULL, 0);
+                break;
+            case 's':
+                seed = strtoul(optarg, NULL, 0);
+                break;
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (0 == seed)
+    {
+        printf("ERR - The seed must not be zero\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (modbus_crc_init() != 0)
+    {
+        printf("ERR - CRC tables failed their self check\n");
+        exit(EXIT_FAILURE);
+    }
+
+    check_random_frames(n_frames, seed);
+    if (bench_bytes > 0)
+        benchmark(bench_bytes, seed);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,7 @@
+#ifndef SHIM_LINUX_CACHE_H_
+#define SHIM_LINUX_CACHE_H_
+
+// No read-only section after init in user space
+#define __ro_after_init
+
+#endif  // SHIM_LINUX_CACHE_H_
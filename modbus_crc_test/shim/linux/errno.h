@@ -0,0 +1,6 @@
+#ifndef SHIM_LINUX_ERRNO_H_
+#define SHIM_LINUX_ERRNO_H_
+
+#include_next <linux/errno.h>
+
+#endif  // SHIM_LINUX_ERRNO_H_
@@ -0,0 +1,9 @@
+#ifndef SHIM_LINUX_PRINTK_H_
+#define SHIM_LINUX_PRINTK_H_
+
+#include <stdio.h>
+
+#define KERN_ERR ""
+#define printk(...) printf(__VA_ARGS__)
+
+#endif  // SHIM_LINUX_PRINTK_H_
@@ -0,0 +1,6 @@
+#ifndef SHIM_LINUX_STRING_H_
+#define SHIM_LINUX_STRING_H_
+
+#include <string.h>
+
+#endif  // SHIM_LINUX_STRING_H_
@@ -135,10 +135,11 @@ static enum command_type_t validate_and_prepare_input(char* input, int length)
     return cmd_type;
 }
 
-static int read_from_modbus(int fd, uint16_t* buf, size_t n_regs)
+// The file offset is the register address, so a single pread()/pwrite() does a whole access
+static int read_from_modbus(int fd, unsigned long address, uint16_t* buf, size_t n_regs)
 {
     size_t n_bytes = n_regs * sizeof(uint16_t);
-    int res = read(fd, buf, n_bytes);
+    int res = pread(fd, buf, n_bytes, address);
     if (res < 0)
     {
         printf("ERR - Could not read from modbus driver: %d\n", res);
@@ -150,10 +151,10 @@ static int read_from_modbus(int fd, uint16_t* buf, size_t n_regs)
     return res;
 }
 
-static int write_to_modbus(int fd, uint16_t* buf, size_t n_regs)
+static int write_to_modbus(int fd, unsigned long address, uint16_t* buf, size_t n_regs)
 {
     size_t n_bytes = n_regs * sizeof(uint16_t);
-    int res = write(fd, buf, n_bytes);
+    int res = pwrite(fd, buf, n_bytes, address);
     if (res < 0)
     {
         printf("ERR - Could not write to modbus driver: %d\n", res);
@@ -165,20 +166,6 @@ static int write_to_modbus(int fd, uint16_t* buf, size_t n_regs)
     return res;
 }
 
-static int set_modbus_address(int fd, unsigned long address)
-{
-    int res = ioctl(fd, SERIAL_MODBUSCHAR_IOCSETADDR, &address);
-    if (res < 0)
-    {
-        printf("ERR - Could not set modbus address %lu. Reason: %d\n", address, res);
-    }
-    else
-    {
-        printf("INFO - Set modbus address to %lu\n", address);
-    }
-    return res;
-}
-
 static void handle_write_command(void)
 {
     LOG_DEBUG("Write command\n");
@@ -204,11 +191,8 @@ static void handle_write_command(void)
             else
             {
                 printf("Writing %u to register \"%s\" at address %u\n", value, name, hash_table_entry->addr);
-                if (set_modbus_address(fd, hash_table_entry->addr) >= 0)
-                {
-                    uint16_t value_16bits = (uint16_t)value;
-                    write_to_modbus(fd, &value_16bits, 1);
-                }
+                uint16_t value_16bits = (uint16_t)value;
+                write_to_modbus(fd, (unsigned long)hash_table_entry->addr, &value_16bits, 1);
             }
         }
     }
@@ -236,10 +220,9 @@ static void handle_read_command(void)
         else
         {
             printf("Reading register \"%s\" at address %u\n", name, hash_table_entry->addr);
-            if (set_modbus_address(fd, hash_table_entry->addr) >= 0)
+            uint16_t value = 0;
+            if (read_from_modbus(fd, (unsigned long)hash_table_entry->addr, &value, 1) >= 0)
             {
-                uint16_t value = 0;
-                read_from_modbus(fd, &value, 1);
                 printf("\"%s\" = %u\n", name, value);
             }
         }
@@ -101,12 +101,13 @@ void write_to_modbus(int fd, uint16_t* buf, size_t n_regs)
     }
 }
 
+// The file position is the register address, read() and write() do not move it
 void set_modbus_address(int fd, unsigned long address)
 {
-    int res = ioctl(fd, SERIAL_MODBUSCHAR_IOCSETADDR, &address);
+    off_t res = lseek(fd, address, SEEK_SET);
     if (res < 0)
     {
-        printf("ERR - Could not set modbus address %lu. Reason: %d\n", address, res);
+        printf("ERR - Could not set modbus address %lu. Reason: %d\n", address, errno);
     }
     else
     {
@@ -185,11 +186,19 @@ int main(int argc, char* argv[])
     set_modbus_address(fd, new_address);
     LOG_DEBUG("Done! \n");
 
-    LOG_DEBUG(">> Reading too much... \n");
-    n_regs = 65;
+    LOG_DEBUG(">> Reading past the last register... \n");
+    set_modbus_address(fd, UINT16_MAX - 7);
+    n_regs = 16;
     read_from_modbus(fd, buf, n_regs);
     LOG_DEBUG("Done! \n");
 
+    LOG_DEBUG(">> Reading more than one request can carry... \n");
+    set_modbus_address(fd, 0);
+    uint16_t large_buf[300];
+    n_regs = 300;
+    read_from_modbus(fd, large_buf, n_regs);
+    LOG_DEBUG("Done! \n");
+
     cleanup();
 
     return EXIT_SUCCESS;
@@ -1,6 +1,10 @@
 #include "byte_fifo.h"
 
+#include <asm/barrier.h>
+#include <linux/compiler.h>
 #include <linux/errno.h>
+#include <linux/log2.h>
+#include <linux/minmax.h>
 #include <linux/string.h>
 
 #define RETURN_IF(x, y) \
@@ -9,9 +13,13 @@
 int16_t byte_fifo_init(struct byte_fifo_t* const fifo)
 {
     RETURN_IF(NULL == fifo, -EFAULT);
-    mutex_init(&fifo->lock);
+    RETURN_IF(NULL == fifo->data, -EFAULT);
+    RETURN_IF(!is_power_of_2(fifo->size), -EINVAL);
 
-    byte_fifo_reset(fifo);
+    fifo->mask = fifo->size - 1;
+    fifo->write_index = 0U;
+    fifo->read_index = 0U;
+    memset((void*)fifo->data, 0, fifo->size);
 
     return 0;
 }
@@ -22,12 +30,8 @@ int16_t byte_fifo_reset(struct byte_fifo_t* const fifo)
     RETURN_IF(NULL == fifo->data, -EFAULT);
     RETURN_IF(0 == fifo->size, -EFAULT);
 
-    mutex_lock(&fifo->lock);
-    fifo->write_index = 0U;
-    fifo->read_index = 0U;
-    fifo->n_elements = 0U;
-    memset((void*)fifo->data, 0, fifo->size);
-    mutex_unlock(&fifo->lock);
+    // Consumer side: drop everything that was published so far
+    smp_store_release(&fifo->read_index, smp_load_acquire(&fifo->write_index));
 
     return 0;
 }
@@ -36,11 +40,17 @@ int16_t byte_fifo_is_available(struct byte_fifo_t* const fifo)
 {
     RETURN_IF(NULL == fifo, -EFAULT);
 
-    mutex_lock(&fifo->lock);
-    int is_available = (fifo->n_elements < fifo->size);
-    mutex_unlock(&fifo->lock);
+    return (byte_fifo_count(fifo) < fifo->size);
+}
+
+int16_t byte_fifo_count(struct byte_fifo_t* const fifo)
+{
+    RETURN_IF(NULL == fifo, -EFAULT);
+
+    unsigned int read_index = smp_load_acquire(&fifo->read_index);
+    unsigned int write_index = smp_load_acquire(&fifo->write_index);
 
-    return is_available;
+    return write_index - read_index;
 }
 
 int16_t byte_fifo_write(struct byte_fifo_t* const fifo, const unsigned char* const bytes, unsigned int len)
@@ -49,33 +59,21 @@ int16_t byte_fifo_write(struct byte_fifo_t* const fifo, const unsigned char* con
     RETURN_IF(NULL == fifo->data, -EFAULT);
     RETURN_IF(NULL == bytes, -EFAULT);
 
-    int n_bytes_written = 0;
-    int n_bytes_overwritten = 0;
-    while (len > 0)
-    {
-        mutex_lock(&fifo->lock);
-        if (fifo->n_elements < fifo->size)
-        {
-            unsigned int write_index = fifo->write_index;
-            fifo->data[write_index] = bytes[n_bytes_written];
-            fifo->write_index = (write_index < (fifo->size - 1)) ? write_index + 1 : 0;
-            fifo->n_elements++;
-
-            // Update
-            n_bytes_written++;
-            len--;
-        }
-        else
-        {
-            unsigned int read_index = fifo->read_index;
-            fifo->read_index = (read_index < (fifo->size - 1)) ? read_index + 1 : 0;
-            fifo->n_elements--;
-            n_bytes_overwritten++;
-        }
-        mutex_unlock(&fifo->lock);
-    }
-
-    return n_bytes_overwritten;
+    // Producer side: only the consumer moves read_index, so bytes that do not fit are dropped
+    const unsigned int write_index = fifo->write_index;
+    const unsigned int read_index = smp_load_acquire(&fifo->read_index);
+    const unsigned int n_free = fifo->size - (write_index - read_index);
+    const unsigned int n_bytes_written = min(len, n_free);
+
+    // Copy in at most two chunks, the second one starting at the beginning of the buffer
+    const unsigned int offset = write_index & fifo->mask;
+    const unsigned int first_chunk = min(n_bytes_written, fifo->size - offset);
+    memcpy(fifo->data + offset, bytes, first_chunk);
+    memcpy(fifo->data, bytes + first_chunk, n_bytes_written - first_chunk);
+
+    smp_store_release(&fifo->write_index, write_index + n_bytes_written);
+
+    return len - n_bytes_written;
 }
 
 int16_t byte_fifo_read(struct byte_fifo_t* const fifo, unsigned char* const buffer, unsigned int max_len)
@@ -84,25 +82,28 @@ int16_t byte_fifo_read(struct byte_fifo_t* const fifo, unsigned char* const buff
     RETURN_IF(NULL == fifo->data, -EFAULT);
     RETURN_IF(NULL == buffer, -EFAULT);
 
-    int n_bytes_read = 0;
-    while (n_bytes_read < max_len)
-    {
-        mutex_lock(&fifo->lock);
-        if (fifo->n_elements > 0)
-        {
-            unsigned int read_index = fifo->read_index;
-            buffer[n_bytes_read] = fifo->data[read_index];
-            fifo->read_index = (read_index < (fifo->size - 1)) ? read_index + 1 : 0;
-            fifo->n_elements--;
-            n_bytes_read++;
-            mutex_unlock(&fifo->lock);
-        }
-        else
-        {
-            mutex_unlock(&fifo->lock);
-            break;
-        }
-    }
+    const unsigned int read_index = fifo->read_index;
+    const unsigned int write_index = smp_load_acquire(&fifo->write_index);
+    const unsigned int n_bytes_read = min(max_len, write_index - read_index);
+
+    const unsigned int offset = read_index & fifo->mask;
+    const unsigned int first_chunk = min(n_bytes_read, fifo->size - offset);
+    memcpy(buffer, fifo->data + offset, first_chunk);
+    memcpy(buffer + first_chunk, fifo->data, n_bytes_read - first_chunk);
+
+    smp_store_release(&fifo->read_index, read_index + n_bytes_read);
 
     return n_bytes_read;
-}
\ No newline at end of file
+}
+
+int16_t byte_fifo_peek(struct byte_fifo_t* const fifo, unsigned int offset)
+{
+    RETURN_IF(NULL == fifo, -EFAULT);
+    RETURN_IF(NULL == fifo->data, -EFAULT);
+
+    const unsigned int read_index = smp_load_acquire(&fifo->read_index);
+    const unsigned int write_index = smp_load_acquire(&fifo->write_index);
+    RETURN_IF(offset >= write_index - read_index, -ENODATA);
+
+    return fifo->data[(read_index + offset) & fifo->mask];
+}
@@ -1,31 +1,41 @@
 #ifndef BYTE_FIFO_H_
 #define BYTE_FIFO_H_
 
-#include <linux/mutex.h>
 #include <linux/types.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif  // __cplusplus
 
+/**
+ * Lock-free single-producer/single-consumer byte ring.
+ *
+ * The producer only ever writes write_index and the consumer only ever writes read_index. Both indexes run
+ * freely and are wrapped with the mask, so size must be a power of two. Indexes are published with
+ * release semantics and read with acquire semantics, which makes the data copied before an index update
+ * visible to the other side.
+ *
+ * byte_fifo_write() is the producer side, byte_fifo_read() and byte_fifo_reset() are the consumer side.
+ */
 struct byte_fifo_t
 {
-    unsigned char* const data;
-    const unsigned int size;
+    unsigned char* data;
+    unsigned int size;
+    unsigned int mask;
     unsigned int write_index;
     unsigned int read_index;
-    unsigned int n_elements;
-    struct mutex lock;
 };
 
 int16_t byte_fifo_init(struct byte_fifo_t* const fifo);
 int16_t byte_fifo_is_available(struct byte_fifo_t* const fifo);
+int16_t byte_fifo_count(struct byte_fifo_t* const fifo);
 int16_t byte_fifo_write(struct byte_fifo_t* const fifo, const unsigned char* const bytes, unsigned int len);
 int16_t byte_fifo_read(struct byte_fifo_t* const fifo, unsigned char* const buffer, unsigned int max_len);
+int16_t byte_fifo_peek(struct byte_fifo_t* const fifo, unsigned int offset);
 int16_t byte_fifo_reset(struct byte_fifo_t* const fifo);
 
 #ifdef __cplusplus
 }
 #endif  // __cplusplus
 
-#endif  // BYTE_FIFO_H_
\ No newline at end of file
+#endif  // BYTE_FIFO_H_
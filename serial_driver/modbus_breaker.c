@@ -0,0 +1,131 @@
+#include "modbus_breaker.h"
+
+#include <linux/errno.h>
+#include <linux/string.h>
+
+#define RETURN_IF(x, y) \
+    if ((x)) return (y)
+
+void modbus_breaker_init(struct modbus_breaker_t* const breaker, uint32_t threshold, uint32_t probe_interval_ms)
+{
+    memset(breaker, 0, sizeof(*breaker));  // All closed
+    spin_lock_init(&breaker->lock);
+    breaker->threshold = threshold;
+    breaker->probe_interval_ms = probe_interval_ms;
+}
+
+int modbus_breaker_configure(struct modbus_breaker_t* const breaker, uint32_t threshold, uint32_t probe_interval_ms)
+{
+    RETURN_IF((threshold < 1) || (probe_interval_ms < 1), -EINVAL);
+
+    spin_lock(&breaker->lock);
+    breaker->threshold = threshold;
+    breaker->probe_interval_ms = probe_interval_ms;
+    spin_unlock(&breaker->lock);
+
+    return 0;
+}
+
+bool modbus_breaker_allow(struct modbus_breaker_t* const breaker, uint8_t slave)
+{
+    RETURN_IF(slave > MODBUS_MAX_UNIT_ID, true);
+
+    // Only the background probe talks to a slave that is not closed
+    spin_lock(&breaker->lock);
+    const bool allow = (MODBUS_BREAKER_CLOSED == breaker->slaves[slave].state);
+    spin_unlock(&breaker->lock);
+
+    return allow;
+}
+
+void modbus_breaker_success(struct modbus_breaker_t* const breaker, uint8_t slave)
+{
+    if (slave > MODBUS_MAX_UNIT_ID)
+    {
+        return;
+    }
+
+    spin_lock(&breaker->lock);
+    breaker->slaves[slave].state = MODBUS_BREAKER_CLOSED;
+    breaker->slaves[slave].failures = 0;
+    spin_unlock(&breaker->lock);
+}
+
+bool modbus_breaker_failure(struct modbus_breaker_t* const breaker, uint8_t slave, ktime_t now)
+{
+    RETURN_IF(slave > MODBUS_MAX_UNIT_ID, false);
+
+    bool opened = false;
+
+    spin_lock(&breaker->lock);
+    struct modbus_breaker_slave_t* health = &breaker->slaves[slave];
+    health->failures++;
+
+    // A failed probe keeps the breaker open, too many timeouts in a row open it
+    if ((MODBUS_BREAKER_HALF_OPEN == health->state) ||
+        ((MODBUS_BREAKER_CLOSED == health->state) && (health->failures >= breaker->threshold)))
+    {
+        if (MODBUS_BREAKER_CLOSED == health->state)
+        {
+            health->trips++;
+        }
+        health->state = MODBUS_BREAKER_OPEN;
+        health->next_probe = ktime_add_ms(now, breaker->probe_interval_ms);
+        opened = true;
+    }
+    spin_unlock(&breaker->lock);
+
+    return opened;
+}
+
+bool modbus_breaker_next_probe(struct modbus_breaker_t* const breaker, ktime_t now, uint8_t* const slave)
+{
+    bool found = false;
+
+    spin_lock(&breaker->lock);
+    for (unsigned int i = 0; i <= MODBUS_MAX_UNIT_ID; i++)
+    {
+        struct modbus_breaker_slave_t* health = &breaker->slaves[i];
+        if ((MODBUS_BREAKER_OPEN == health->state) && (health->next_probe <= now))
+        {
+            health->state = MODBUS_BREAKER_HALF_OPEN;
+            *slave = i;
+            found = true;
+            break;
+        }
+    }
+    spin_unlock(&breaker->lock);
+
+    return found;
+}
+
+ktime_t modbus_breaker_next_due(struct modbus_breaker_t* const breaker)
+{
+    ktime_t next_due = KTIME_MAX;
+
+    spin_lock(&breaker->lock);
+    for (unsigned int i = 0; i <= MODBUS_MAX_UNIT_ID; i++)
+    {
+        const struct modbus_breaker_slave_t* health = &breaker->slaves[i];
+        if ((MODBUS_BREAKER_OPEN == health->state) && (health->next_probe < next_due))
+        {
+            next_due = health->next_probe;
+        }
+    }
+    spin_unlock(&breaker->lock);
+
+    return next_due;
+}
+
+// Time of the next probe of a slave that is not closed, 0 if requests to it go through
+ktime_t modbus_breaker_offline_until(struct modbus_breaker_t* const breaker, uint8_t slave)
+{
+    RETURN_IF(slave > MODBUS_MAX_UNIT_ID, 0);
+
+    spin_lock(&breaker->lock);
+    const struct modbus_breaker_slave_t* health = &breaker->slaves[slave];
+    const ktime_t until = (MODBUS_BREAKER_CLOSED == health->state) ? 0 : health->next_probe;
+    spin_unlock(&breaker->lock);
+
+    return until;
+}
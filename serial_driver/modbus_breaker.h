@@ -0,0 +1,55 @@
+#ifndef MODBUS_BREAKER_H_
+#define MODBUS_BREAKER_H_
+
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include "modbus_scan.h"  // MODBUS_MAX_UNIT_ID
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+enum modbus_breaker_state_t
+{
+    MODBUS_BREAKER_CLOSED,     // Slave answers, requests go through
+    MODBUS_BREAKER_OPEN,       // Slave considered offline, requests fail right away
+    MODBUS_BREAKER_HALF_OPEN,  // A probe is checking whether the slave is back
+};
+
+struct modbus_breaker_slave_t
+{
+    enum modbus_breaker_state_t state;
+    uint32_t failures;  // Consecutive timeouts
+    uint32_t trips;     // Times the breaker opened
+    ktime_t next_probe;
+};
+
+/**
+ * Health of each slave of a port. After threshold consecutive timeouts a slave is considered
+ * offline: requests to it fail immediately instead of holding the bus for a whole timeout, and
+ * it is probed every probe_interval_ms until it answers again.
+ */
+struct modbus_breaker_t
+{
+    spinlock_t lock;  // Protects everything below
+    uint32_t threshold;
+    uint32_t probe_interval_ms;
+    struct modbus_breaker_slave_t slaves[MODBUS_MAX_UNIT_ID + 1];
+};
+
+void modbus_breaker_init(struct modbus_breaker_t* const breaker, uint32_t threshold, uint32_t probe_interval_ms);
+int modbus_breaker_configure(struct modbus_breaker_t* const breaker, uint32_t threshold, uint32_t probe_interval_ms);
+bool modbus_breaker_allow(struct modbus_breaker_t* const breaker, uint8_t slave);
+void modbus_breaker_success(struct modbus_breaker_t* const breaker, uint8_t slave);
+bool modbus_breaker_failure(struct modbus_breaker_t* const breaker, uint8_t slave, ktime_t now);
+bool modbus_breaker_next_probe(struct modbus_breaker_t* const breaker, ktime_t now, uint8_t* const slave);
+ktime_t modbus_breaker_next_due(struct modbus_breaker_t* const breaker);
+ktime_t modbus_breaker_offline_until(struct modbus_breaker_t* const breaker, uint8_t slave);
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#endif  // MODBUS_BREAKER_H_
@@ -0,0 +1,155 @@
+#include "modbus_capture.h"
+
+#include <linux/errno.h>
+#include <linux/ktime.h>
+#include <linux/limits.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/minmax.h>
+#include <linux/string.h>
+#include <linux/timekeeping.h>
+#include <linux/vmalloc.h>
+
+#define RETURN_IF(x, y) \
+    if ((x)) return (y)
+
+// pcap file format with nanosecond timestamps, in host byte order
+#define PCAP_MAGIC_NSEC 0xa1b23c4d
+
+struct pcap_header_t
+{
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_record_t
+{
+    uint32_t ts_sec;
+    uint32_t ts_nsec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+void modbus_capture_init(struct modbus_capture_t* const capture)
+{
+    memset(capture, 0, sizeof(*capture));
+    spin_lock_init(&capture->lock);
+}
+
+void modbus_capture_cleanup(struct modbus_capture_t* const capture)
+{
+    vfree(capture->frames);
+    capture->frames = NULL;
+    capture->size = 0;
+}
+
+int modbus_capture_start(struct modbus_capture_t* const capture, unsigned int size)
+{
+    RETURN_IF(!is_power_of_2(size), -EINVAL);
+
+    struct modbus_capture_frame_t* frames = NULL;
+    if (NULL == READ_ONCE(capture->frames))
+    {
+        frames = vmalloc(size * sizeof(struct modbus_capture_frame_t));
+        RETURN_IF(NULL == frames, -ENOMEM);
+    }
+
+    spin_lock(&capture->lock);
+    if (NULL == capture->frames)
+    {
+        capture->frames = frames;
+        capture->size = size;
+        frames = NULL;
+    }
+    capture->next = 0;
+    capture->enabled = true;
+    spin_unlock(&capture->lock);
+
+    vfree(frames);  // Lost a race with another start
+    return 0;
+}
+
+void modbus_capture_stop(struct modbus_capture_t* const capture)
+{
+    // Frames recorded so far stay readable
+    spin_lock(&capture->lock);
+    capture->enabled = false;
+    spin_unlock(&capture->lock);
+}
+
+void modbus_capture_frame(struct modbus_capture_t* const capture, enum modbus_capture_direction_t direction, const uint8_t* data, size_t length)
+{
+    if (!READ_ONCE(capture->enabled))
+    {
+        return;
+    }
+
+    const u64 now = ktime_get_real_ns();
+    spin_lock(&capture->lock);
+    if (capture->enabled)
+    {
+        struct modbus_capture_frame_t* frame = &capture->frames[capture->next++ & (capture->size - 1)];
+        frame->real_ns = now;
+        frame->length = min_t(size_t, length, U16_MAX);
+        frame->direction = direction;
+        memcpy(frame->data, data, min_t(size_t, length, MODBUS_CAPTURE_SNAPLEN));
+    }
+    spin_unlock(&capture->lock);
+}
+
+// Largest pcap file a ring of size frames turns into
+size_t modbus_capture_pcap_size(unsigned int size)
+{
+    return sizeof(struct pcap_header_t) + size * (sizeof(struct pcap_record_t) + 1 + MODBUS_CAPTURE_SNAPLEN);
+}
+
+// Writes the frames in the ring, oldest first, as a pcap file. Every packet starts with its
+// direction byte. Returns the length of the file.
+size_t modbus_capture_pcap(struct modbus_capture_t* const capture, void* const out, size_t out_size)
+{
+    const struct pcap_header_t header = {
+        .magic = PCAP_MAGIC_NSEC,
+        .version_major = 2,
+        .version_minor = 4,
+        .snaplen = 1 + MODBUS_CAPTURE_SNAPLEN,
+        .linktype = MODBUS_CAPTURE_LINKTYPE,
+    };
+    uint8_t* pos = out;
+
+    RETURN_IF(out_size < sizeof(header), 0);
+    memcpy(pos, &header, sizeof(header));
+    pos += sizeof(header);
+
+    spin_lock(&capture->lock);
+    const uint64_t n_frames = min_t(uint64_t, capture->next, capture->size);
+    for (uint64_t i = capture->next - n_frames; i < capture->next; i++)
+    {
+        const struct modbus_capture_frame_t* frame = &capture->frames[i & (capture->size - 1)];
+        const uint32_t incl_len = 1 + min_t(uint32_t, frame->length, MODBUS_CAPTURE_SNAPLEN);
+        if ((size_t)(pos - (uint8_t*)out) + sizeof(struct pcap_record_t) + incl_len > out_size)
+        {
+            break;
+        }
+
+        u32 ts_nsec;
+        struct pcap_record_t record = {
+            .ts_sec = div_u64_rem(frame->real_ns, NSEC_PER_SEC, &ts_nsec),
+            .incl_len = incl_len,
+            .orig_len = 1 + frame->length,
+        };
+        record.ts_nsec = ts_nsec;
+        memcpy(pos, &record, sizeof(record));
+        pos += sizeof(record);
+        *pos++ = frame->direction;
+        memcpy(pos, frame->data, incl_len - 1);
+        pos += incl_len - 1;
+    }
+    spin_unlock(&capture->lock);
+
+    return pos - (uint8_t*)out;
+}
@@ -0,0 +1,55 @@
+#ifndef MODBUS_CAPTURE_H_
+#define MODBUS_CAPTURE_H_
+
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+#define MODBUS_CAPTURE_SNAPLEN 256  // Longest Modbus RTU frame, longer chunks are truncated
+#define MODBUS_CAPTURE_LINKTYPE 147  // LINKTYPE_USER0, there is no link type for Modbus RTU
+
+// First byte of every captured packet
+enum modbus_capture_direction_t
+{
+    MODBUS_CAPTURE_TX = 0,  // Written to the serial port
+    MODBUS_CAPTURE_RX = 1,  // Delivered by the receive callback
+};
+
+struct modbus_capture_frame_t
+{
+    u64 real_ns;  // Wall clock, pcap wants absolute times
+    uint16_t length;  // Before truncation
+    uint8_t direction;
+    uint8_t data[MODBUS_CAPTURE_SNAPLEN];
+};
+
+/**
+ * Ring of the raw bytes going over the serial port of a port, for export as a pcap file. Frames
+ * are recorded as written, received bytes as delivered by serdev, which may split or merge frames.
+ * The ring is allocated on first start and kept until cleanup.
+ */
+struct modbus_capture_t
+{
+    spinlock_t lock;  // Protects everything below
+    bool enabled;
+    struct modbus_capture_frame_t* frames;
+    unsigned int size;  // A power of two
+    uint64_t next;      // Frames recorded since the capture started
+};
+
+void modbus_capture_init(struct modbus_capture_t* const capture);
+void modbus_capture_cleanup(struct modbus_capture_t* const capture);
+int modbus_capture_start(struct modbus_capture_t* const capture, unsigned int size);
+void modbus_capture_stop(struct modbus_capture_t* const capture);
+void modbus_capture_frame(struct modbus_capture_t* const capture, enum modbus_capture_direction_t direction, const uint8_t* data, size_t length);
+size_t modbus_capture_pcap_size(unsigned int size);
+size_t modbus_capture_pcap(struct modbus_capture_t* const capture, void* const out, size_t out_size);
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#endif  // MODBUS_CAPTURE_H_
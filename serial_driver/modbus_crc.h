@@ -0,0 +1,29 @@
+#ifndef MODBUS_CRC_H_
+#define MODBUS_CRC_H_
+
+#include <linux/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+// Initial CRC-16/MODBUS state
+#define MODBUS_CRC_INIT 0xFFFF
+
+/**
+ * Build the slice-by-4 tables and check them against the bitwise reference.
+ * Must be called once before any other function of this module.
+ */
+int modbus_crc_init(void);
+
+/**
+ * Fold len bytes into a running CRC-16/MODBUS state, starting from MODBUS_CRC_INIT.
+ * The result is the plain CRC value, whose low byte is sent first on the wire.
+ */
+uint16_t modbus_crc_update(uint16_t crc, const uint8_t* data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#endif  // MODBUS_CRC_H_
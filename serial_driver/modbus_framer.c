@@ -0,0 +1,143 @@
+#include "modbus_framer.h"
+
+#include <linux/math64.h>
+#include <linux/minmax.h>
+#include <linux/string.h>
+
+#define RETURN_IF(x, y) \
+    if ((x)) return (y)
+
+// Start, 8 data, parity or second stop and stop bits
+#define MODBUS_RTU_CHAR_BITS 11
+
+// Above 19200 baud the specification fixes the inter-character and inter-frame delays
+#define MODBUS_RTU_FIXED_TIMING_BAUD 19200
+#define MODBUS_RTU_FIXED_T15_NS      750000
+#define MODBUS_RTU_FIXED_T35_NS      1750000
+
+static uint32_t modbus_framer_chars_ns(uint32_t baud, uint32_t half_chars)
+{
+    return div_u64((u64)half_chars * MODBUS_RTU_CHAR_BITS * NSEC_PER_SEC, 2 * max_t(uint32_t, baud, 1));
+}
+
+uint32_t modbus_framer_char_ns(uint32_t baud)
+{
+    return modbus_framer_chars_ns(baud, 2);
+}
+
+uint32_t modbus_framer_t15_ns(uint32_t baud)
+{
+    RETURN_IF(baud > MODBUS_RTU_FIXED_TIMING_BAUD, MODBUS_RTU_FIXED_T15_NS);
+    return modbus_framer_chars_ns(baud, 3);
+}
+
+uint32_t modbus_framer_t35_ns(uint32_t baud)
+{
+    RETURN_IF(baud > MODBUS_RTU_FIXED_TIMING_BAUD, MODBUS_RTU_FIXED_T35_NS);
+    return modbus_framer_chars_ns(baud, 7);
+}
+
+void modbus_framer_init(struct modbus_framer_t* const framer, uint32_t baud)
+{
+    memset(framer, 0, sizeof(*framer));
+    spin_lock_init(&framer->lock);
+    framer->char_ns = modbus_framer_chars_ns(baud, 2);
+    framer->t15_ns = modbus_framer_t15_ns(baud);
+    framer->t35_ns = modbus_framer_t35_ns(baud);
+}
+
+void modbus_framer_set_baud(struct modbus_framer_t* const framer, uint32_t baud)
+{
+    spin_lock(&framer->lock);
+    framer->char_ns = modbus_framer_chars_ns(baud, 2);
+    framer->t15_ns = modbus_framer_t15_ns(baud);
+    framer->t35_ns = modbus_framer_t35_ns(baud);
+    spin_unlock(&framer->lock);
+}
+
+void modbus_framer_reset(struct modbus_framer_t* const framer)
+{
+    spin_lock(&framer->lock);
+    framer->overflow = false;
+    framer->broken = false;
+    framer->head = 0;
+    framer->tail = 0;
+    framer->bursts[0].length = 0;
+    spin_unlock(&framer->lock);
+}
+
+// Ends the burst being received, called with the lock held
+static void modbus_framer_close(struct modbus_framer_t* const framer)
+{
+    struct modbus_framer_burst_t* burst = &framer->bursts[framer->head % MODBUS_FRAMER_BURSTS];
+    if (0 == burst->length)
+    {
+        return;
+    }
+
+    // The oldest complete burst stays, the reader is already behind
+    if (framer->broken)
+    {
+        framer->broken_bursts++;
+    }
+    else if (framer->overflow || (framer->head - framer->tail >= MODBUS_FRAMER_BURSTS - 1))
+    {
+        framer->dropped++;
+    }
+    else
+    {
+        framer->head++;
+    }
+    framer->overflow = false;
+    framer->broken = false;
+    framer->bursts[framer->head % MODBUS_FRAMER_BURSTS].length = 0;
+}
+
+void modbus_framer_feed(struct modbus_framer_t* const framer, const uint8_t* data, size_t length, ktime_t now)
+{
+    spin_lock(&framer->lock);
+
+    // The first byte of the chunk arrived about length characters ago
+    const s64 gap_ns = ktime_to_ns(ktime_sub(now, framer->last_byte)) - (s64)length * framer->char_ns;
+    if (gap_ns >= framer->t35_ns)
+    {
+        modbus_framer_close(framer);
+    }
+
+    struct modbus_framer_burst_t* burst = &framer->bursts[framer->head % MODBUS_FRAMER_BURSTS];
+    if ((burst->length > 0) && (gap_ns > framer->t15_ns))
+    {
+        framer->broken = true;
+    }
+    const size_t n_copy = min_t(size_t, length, MODBUS_FRAMER_MAX_BURST - burst->length);
+    memcpy(&burst->data[burst->length], data, n_copy);
+    burst->length += n_copy;
+    burst->end = now;
+    framer->overflow |= (n_copy < length);
+    framer->last_byte = now;
+
+    spin_unlock(&framer->lock);
+}
+
+// Takes the oldest complete burst, the one being received counts as complete once the line was
+// silent for t3.5. Returns false if there is none.
+bool modbus_framer_pop(struct modbus_framer_t* const framer, ktime_t now, struct modbus_framer_burst_t* const burst)
+{
+    bool found = false;
+
+    spin_lock(&framer->lock);
+    if ((framer->head == framer->tail) && (ktime_to_ns(ktime_sub(now, framer->last_byte)) >= framer->t35_ns))
+    {
+        modbus_framer_close(framer);
+    }
+
+    if (framer->head != framer->tail)
+    {
+        *burst = framer->bursts[framer->tail % MODBUS_FRAMER_BURSTS];
+        framer->tail++;
+        found = true;
+    }
+    spin_unlock(&framer->lock);
+
+    return found;
+}
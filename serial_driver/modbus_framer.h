@@ -0,0 +1,60 @@
+#ifndef MODBUS_FRAMER_H_
+#define MODBUS_FRAMER_H_
+
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+#define MODBUS_FRAMER_MAX_BURST 512  // A request and its response received without a gap
+#define MODBUS_FRAMER_BURSTS    16
+
+// Bytes received without a t3.5 silence between them. Usually one frame, but serdev may hand
+// over a request and a quick response as a single chunk.
+struct modbus_framer_burst_t
+{
+    ktime_t end;  // Last bytes received
+    uint16_t length;
+    uint8_t data[MODBUS_FRAMER_MAX_BURST];
+};
+
+/**
+ * Splits a stream of received bytes into bursts at every silence of at least t3.5 character
+ * times, as Modbus RTU delimits frames. A burst with a silence of more than t1.5 within it is
+ * dropped, as RTU does with a frame interrupted that long. Received chunks only carry the time
+ * they were handed over, the gap before a chunk is estimated from the time its bytes took on the
+ * line.
+ */
+struct modbus_framer_t
+{
+    spinlock_t lock;  // Protects everything below
+    uint32_t char_ns;  // One character of 11 bits
+    uint32_t t15_ns;
+    uint32_t t35_ns;
+    ktime_t last_byte;
+    bool overflow;  // The burst being received is too long, it will be dropped
+    bool broken;    // The burst being received had a gap over t1.5, it will be dropped
+    struct modbus_framer_burst_t bursts[MODBUS_FRAMER_BURSTS];  // Complete ones from tail to head
+    unsigned int head;  // Burst being received
+    unsigned int tail;
+    uint32_t dropped;  // Bursts lost because they were too long or nobody took them
+    uint32_t broken_bursts;  // Bursts dropped for a gap over t1.5 within them
+};
+
+uint32_t modbus_framer_char_ns(uint32_t baud);
+uint32_t modbus_framer_t15_ns(uint32_t baud);
+uint32_t modbus_framer_t35_ns(uint32_t baud);
+void modbus_framer_init(struct modbus_framer_t* const framer, uint32_t baud);
+void modbus_framer_set_baud(struct modbus_framer_t* const framer, uint32_t baud);
+void modbus_framer_reset(struct modbus_framer_t* const framer);
+void modbus_framer_feed(struct modbus_framer_t* const framer, const uint8_t* data, size_t length, ktime_t now);
+bool modbus_framer_pop(struct modbus_framer_t* const framer, ktime_t now, struct modbus_framer_burst_t* const burst);
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#endif  // MODBUS_FRAMER_H_
@@ -0,0 +1,98 @@
+#include "modbus_rtt.h"
+
+#include <linux/errno.h>
+#include <linux/kernel.h>
+#include <linux/minmax.h>
+
+#define RETURN_IF(x, y) \
+    if ((x)) return (y)
+
+// Lower bound of the variance term, covers the scheduling jitter of the receive path
+#define MODBUS_RTT_GRANULARITY_US 2000
+
+static void update_rto(struct modbus_rtt_t* rtt, struct modbus_rtt_slave_t* slave)
+{
+    const uint32_t rto_us = slave->srtt_us + max_t(uint32_t, 4 * slave->rttvar_us, MODBUS_RTT_GRANULARITY_US);
+    slave->rto_ms = clamp_t(uint32_t, DIV_ROUND_UP(rto_us, 1000), rtt->min_ms, rtt->max_ms);
+}
+
+void modbus_rtt_init(struct modbus_rtt_t* const rtt, uint32_t initial_ms, uint32_t min_ms, uint32_t max_ms)
+{
+    spin_lock_init(&rtt->lock);
+    rtt->initial_ms = initial_ms;
+    rtt->min_ms = min_ms;
+    rtt->max_ms = max_ms;
+
+    for (unsigned int i = 0; i <= MODBUS_MAX_UNIT_ID; i++)
+    {
+        rtt->slaves[i] = (struct modbus_rtt_slave_t){.rto_ms = clamp(initial_ms, min_ms, max_ms)};
+    }
+}
+
+int modbus_rtt_set_bounds(struct modbus_rtt_t* const rtt, uint32_t min_ms, uint32_t max_ms)
+{
+    RETURN_IF((min_ms < 1) || (min_ms > max_ms), -EINVAL);
+
+    spin_lock(&rtt->lock);
+    rtt->min_ms = min_ms;
+    rtt->max_ms = max_ms;
+    for (unsigned int i = 0; i <= MODBUS_MAX_UNIT_ID; i++)
+    {
+        struct modbus_rtt_slave_t* slave = &rtt->slaves[i];
+        slave->rto_ms = clamp(slave->rto_ms, min_ms, max_ms);
+    }
+    spin_unlock(&rtt->lock);
+
+    return 0;
+}
+
+uint32_t modbus_rtt_timeout_ms(struct modbus_rtt_t* const rtt, uint8_t slave)
+{
+    RETURN_IF(slave > MODBUS_MAX_UNIT_ID, rtt->max_ms);
+
+    spin_lock(&rtt->lock);
+    const uint32_t rto_ms = rtt->slaves[slave].rto_ms;
+    spin_unlock(&rtt->lock);
+
+    return rto_ms;
+}
+
+void modbus_rtt_sample(struct modbus_rtt_t* const rtt, uint8_t slave, uint32_t rtt_us)
+{
+    if (slave > MODBUS_MAX_UNIT_ID)
+    {
+        return;
+    }
+
+    spin_lock(&rtt->lock);
+    struct modbus_rtt_slave_t* estimate = &rtt->slaves[slave];
+    if (0 == estimate->samples)
+    {
+        estimate->srtt_us = rtt_us;
+        estimate->rttvar_us = rtt_us / 2;
+    }
+    else
+    {
+        // RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, then SRTT = 7/8 SRTT + 1/8 R
+        const uint32_t deviation = (estimate->srtt_us > rtt_us) ? estimate->srtt_us - rtt_us : rtt_us - estimate->srtt_us;
+        estimate->rttvar_us = estimate->rttvar_us - (estimate->rttvar_us >> 2) + (deviation >> 2);
+        estimate->srtt_us = estimate->srtt_us - (estimate->srtt_us >> 3) + (rtt_us >> 3);
+    }
+    estimate->samples++;
+    update_rto(rtt, estimate);
+    spin_unlock(&rtt->lock);
+}
+
+void modbus_rtt_expired(struct modbus_rtt_t* const rtt, uint8_t slave)
+{
+    if (slave > MODBUS_MAX_UNIT_ID)
+    {
+        return;
+    }
+
+    // Back off until the slave answers again, the next sample brings the timeout back down
+    spin_lock(&rtt->lock);
+    struct modbus_rtt_slave_t* estimate = &rtt->slaves[slave];
+    estimate->rto_ms = min(2 * estimate->rto_ms, rtt->max_ms);
+    spin_unlock(&rtt->lock);
+}
@@ -0,0 +1,46 @@
+#ifndef MODBUS_RTT_H_
+#define MODBUS_RTT_H_
+
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include "modbus_scan.h"  // MODBUS_MAX_UNIT_ID
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+// Round trip time estimate of one slave
+struct modbus_rtt_slave_t
+{
+    uint32_t srtt_us;    // Smoothed round trip time
+    uint32_t rttvar_us;  // Smoothed mean deviation of the round trip time
+    uint32_t rto_ms;     // Response timeout derived from the two above
+    uint32_t samples;
+};
+
+/**
+ * Response timeouts learned from the round trip times of each slave, the way TCP computes its
+ * retransmission timeout (RFC 6298): RTO = SRTT + 4 * RTTVAR, doubled on every timeout and
+ * kept within [min_ms, max_ms].
+ */
+struct modbus_rtt_t
+{
+    spinlock_t lock;  // Protects everything below
+    uint32_t initial_ms;  // Timeout of a slave without samples
+    uint32_t min_ms;
+    uint32_t max_ms;
+    struct modbus_rtt_slave_t slaves[MODBUS_MAX_UNIT_ID + 1];
+};
+
+void modbus_rtt_init(struct modbus_rtt_t* const rtt, uint32_t initial_ms, uint32_t min_ms, uint32_t max_ms);
+int modbus_rtt_set_bounds(struct modbus_rtt_t* const rtt, uint32_t min_ms, uint32_t max_ms);
+uint32_t modbus_rtt_timeout_ms(struct modbus_rtt_t* const rtt, uint8_t slave);
+void modbus_rtt_sample(struct modbus_rtt_t* const rtt, uint8_t slave, uint32_t rtt_us);
+void modbus_rtt_expired(struct modbus_rtt_t* const rtt, uint8_t slave);
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#endif  // MODBUS_RTT_H_
@@ -0,0 +1,338 @@
+#include "modbus_scan.h"
+
+#include <asm/barrier.h>
+#include <linux/compiler.h>
+#include <linux/errno.h>
+#include <linux/mm.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#define RETURN_IF(x, y) \
+    if ((x)) return (y)
+
+static uint16_t* image_registers(struct serial_modbus_image* image, uint8_t function)
+{
+    return (4 == function) ? image->input_registers : image->holding_registers;
+}
+
+static bool block_overlaps(const struct serial_modbus_scan_block* config, uint8_t slave, uint8_t function, unsigned int start, unsigned int end)
+{
+    return (config->slave == slave) && (config->function == function) && (config->start < end) && (start < (unsigned int)config->start + config->count);
+}
+
+// Narrow the change down to the registers that actually differ from the image
+static void find_change(const uint16_t* image, const uint16_t* registers, uint16_t start, uint16_t count, struct modbus_scan_change_t* change)
+{
+    unsigned int first = 0;
+    unsigned int last = count;
+    while ((first < count) && (image[start + first] == registers[first]))
+    {
+        first++;
+    }
+    while ((last > first) && (image[start + last - 1] == registers[last - 1]))
+    {
+        last--;
+    }
+
+    change->start = start + first;
+    change->count = last - first;
+}
+
+// Writer side of the per-block sequence counters, the scan lock serializes writers.
+// User space only ever sees an even counter around a consistent copy of the block.
+static void image_update_begin(struct serial_modbus_image* image, unsigned int index)
+{
+    WRITE_ONCE(image->block_seq[index], image->block_seq[index] + 1);
+    smp_wmb();
+}
+
+static void image_update_end(struct serial_modbus_image* image, unsigned int index)
+{
+    smp_wmb();
+    WRITE_ONCE(image->block_seq[index], image->block_seq[index] + 1);
+}
+
+// Copy the changed registers, registers[0] being change->start, into the image. Readers of every
+// block overlapping the change have to retry, not only those of the block that was read.
+static void image_write(struct modbus_scan_t* scan, struct serial_modbus_image* image, const struct modbus_scan_change_t* change, const uint16_t* registers)
+{
+    const unsigned int end = (unsigned int)change->start + change->count;
+    for (unsigned int i = 0; i < scan->n_blocks; i++)
+    {
+        if (block_overlaps(&scan->blocks[i].config, change->slave, change->function, change->start, end))
+        {
+            image_update_begin(image, i);
+        }
+    }
+    memcpy(&image_registers(image, change->function)[change->start], registers, change->count * sizeof(uint16_t));
+    for (unsigned int i = 0; i < scan->n_blocks; i++)
+    {
+        if (block_overlaps(&scan->blocks[i].config, change->slave, change->function, change->start, end))
+        {
+            image_update_end(image, i);
+        }
+    }
+}
+
+void modbus_scan_init(struct modbus_scan_t* const scan)
+{
+    memset(scan, 0, sizeof(*scan));
+    mutex_init(&scan->images_lock);
+    spin_lock_init(&scan->lock);
+}
+
+void modbus_scan_cleanup(struct modbus_scan_t* const scan)
+{
+    for (unsigned int slave = 0; slave <= MODBUS_MAX_UNIT_ID; slave++)
+    {
+        vfree(scan->images[slave]);
+        scan->images[slave] = NULL;
+    }
+    scan->n_blocks = 0;
+}
+
+bool modbus_scan_has_image(struct modbus_scan_t* const scan, uint8_t slave)
+{
+    RETURN_IF((slave < 1) || (slave > MODBUS_MAX_UNIT_ID), false);
+
+    spin_lock(&scan->lock);
+    const bool found = (NULL != scan->images[slave]);
+    spin_unlock(&scan->lock);
+
+    return found;
+}
+
+// Map the image of a scanned slave, starting pgoff pages into it
+int modbus_scan_map_image(struct modbus_scan_t* const scan, uint8_t slave, struct vm_area_struct* vma, unsigned long pgoff)
+{
+    RETURN_IF((slave < 1) || (slave > MODBUS_MAX_UNIT_ID), -EINVAL);
+
+    // Mapping may sleep, the mutex keeps the image from being freed meanwhile
+    mutex_lock(&scan->images_lock);
+    struct serial_modbus_image* image = scan->images[slave];
+    const int status = (NULL == image) ? -ENOENT : remap_vmalloc_range(vma, image, pgoff);
+    mutex_unlock(&scan->images_lock);
+
+    return status;
+}
+
+int modbus_scan_add(struct modbus_scan_t* const scan, const struct serial_modbus_scan_block* const config)
+{
+    RETURN_IF((config->slave < 1) || (config->slave > MODBUS_MAX_UNIT_ID), -EINVAL);
+    RETURN_IF((3 != config->function) && (4 != config->function), -EINVAL);
+    RETURN_IF((config->count < 1) || (config->count > MODBUS_MAX_READ_REGISTERS), -EINVAL);
+    RETURN_IF((unsigned int)config->start + config->count > 65536, -EINVAL);
+    RETURN_IF(config->period_ms < SERIAL_MODBUS_MIN_SCAN_PERIOD_MS, -EINVAL);
+    RETURN_IF(0 != config->reserved, -EINVAL);
+
+    // The first block of a slave brings its image. Images only change under the mutex, so they
+    // can be read here without the spinlock.
+    mutex_lock(&scan->images_lock);
+    struct serial_modbus_image* new_image = NULL;
+    if (NULL == scan->images[config->slave])
+    {
+        new_image = vmalloc_user(sizeof(struct serial_modbus_image));
+        if (NULL == new_image)
+        {
+            mutex_unlock(&scan->images_lock);
+            return -ENOMEM;
+        }
+    }
+
+    int index = -ENOSPC;
+    spin_lock(&scan->lock);
+    if (scan->n_blocks < SERIAL_MODBUS_MAX_SCAN_BLOCKS)
+    {
+        if (NULL != new_image)
+        {
+            scan->images[config->slave] = new_image;
+            new_image = NULL;
+        }
+        index = scan->n_blocks++;
+        struct modbus_scan_block_t* block = &scan->blocks[index];
+        block->config = *config;
+        block->next_due = 0;  // Due right away
+        block->valid = false;
+    }
+    spin_unlock(&scan->lock);
+    mutex_unlock(&scan->images_lock);
+
+    vfree(new_image);  // No room for the block
+    return index;
+}
+
+void modbus_scan_clear(struct modbus_scan_t* const scan)
+{
+    mutex_lock(&scan->images_lock);
+    spin_lock(&scan->lock);
+    scan->n_blocks = 0;
+    scan->generation++;
+    spin_unlock(&scan->lock);
+
+    // No slave is scanned anymore. Pages still mapped by user space are only released once unmapped.
+    for (unsigned int slave = 1; slave <= MODBUS_MAX_UNIT_ID; slave++)
+    {
+        struct serial_modbus_image* image = scan->images[slave];
+        if (NULL != image)
+        {
+            spin_lock(&scan->lock);
+            scan->images[slave] = NULL;
+            spin_unlock(&scan->lock);
+            vfree(image);
+        }
+    }
+    mutex_unlock(&scan->images_lock);
+}
+
+bool modbus_scan_next(struct modbus_scan_t* const scan, ktime_t now, struct serial_modbus_scan_block* const config, unsigned int* const index, unsigned int* const generation)
+{
+    bool found = false;
+
+    spin_lock(&scan->lock);
+
+    // Most overdue block first, so a slow block does not starve the others
+    struct modbus_scan_block_t* next = NULL;
+    for (unsigned int i = 0; i < scan->n_blocks; i++)
+    {
+        struct modbus_scan_block_t* block = &scan->blocks[i];
+        if ((block->next_due <= now) && ((NULL == next) || (block->next_due < next->next_due)))
+        {
+            next = block;
+        }
+    }
+
+    if (NULL != next)
+    {
+        // Keep the cadence, but do not try to catch up on cycles missed while the bus was busy
+        const ktime_t period = ms_to_ktime(next->config.period_ms);
+        next->next_due = ktime_add(next->next_due, period);
+        if (next->next_due <= now)
+        {
+            next->next_due = ktime_add(now, period);
+        }
+
+        *config = next->config;
+        *index = next - scan->blocks;
+        *generation = scan->generation;
+        found = true;
+    }
+
+    spin_unlock(&scan->lock);
+    return found;
+}
+
+ktime_t modbus_scan_next_due(struct modbus_scan_t* const scan)
+{
+    ktime_t next_due = KTIME_MAX;
+
+    spin_lock(&scan->lock);
+    for (unsigned int i = 0; i < scan->n_blocks; i++)
+    {
+        if (scan->blocks[i].next_due < next_due)
+        {
+            next_due = scan->blocks[i].next_due;
+        }
+    }
+    spin_unlock(&scan->lock);
+
+    return next_due;
+}
+
+// Hold back a block handed out by modbus_scan_next() without running it
+void modbus_scan_postpone(struct modbus_scan_t* const scan, unsigned int index, unsigned int generation, ktime_t until)
+{
+    spin_lock(&scan->lock);
+    if ((generation == scan->generation) && (index < scan->n_blocks) && (scan->blocks[index].next_due < until))
+    {
+        scan->blocks[index].next_due = until;
+    }
+    spin_unlock(&scan->lock);
+}
+
+void modbus_scan_complete(struct modbus_scan_t* const scan, unsigned int index, unsigned int generation, const uint16_t* const registers, bool success, struct modbus_scan_change_t* const change)
+{
+    change->count = 0;
+
+    spin_lock(&scan->lock);
+
+    // The list was cleared while the transaction was running
+    if ((generation != scan->generation) || (index >= scan->n_blocks))
+    {
+        spin_unlock(&scan->lock);
+        return;
+    }
+
+    struct modbus_scan_block_t* block = &scan->blocks[index];
+    block->valid = success;
+    if (success)
+    {
+        struct serial_modbus_image* image = scan->images[block->config.slave];
+        uint16_t* image_block = image_registers(image, block->config.function);
+        change->slave = block->config.slave;
+        change->function = block->config.function;
+        find_change(image_block, registers, block->config.start, block->config.count, change);
+        if (change->count > 0)
+        {
+            image_write(scan, image, change, &registers[change->start - block->config.start]);
+        }
+    }
+
+    spin_unlock(&scan->lock);
+}
+
+int modbus_scan_read(struct modbus_scan_t* const scan, uint8_t slave, uint8_t function, uint16_t start, uint16_t count, uint16_t* const registers)
+{
+    RETURN_IF((slave < 1) || (slave > MODBUS_MAX_UNIT_ID), -ENOENT);
+
+    int status = -ENOENT;
+    const unsigned int end = (unsigned int)start + count;
+
+    spin_lock(&scan->lock);
+    for (unsigned int i = 0; i < scan->n_blocks; i++)
+    {
+        const struct modbus_scan_block_t* block = &scan->blocks[i];
+        const struct serial_modbus_scan_block* config = &block->config;
+        if (block->valid && (config->slave == slave) && (config->function == function) &&
+            (config->start <= start) && ((unsigned int)config->start + config->count >= end))
+        {
+            const uint16_t* image = image_registers(scan->images[slave], function);
+            memcpy(registers, &image[start], count * sizeof(uint16_t));
+            status = 0;
+            break;
+        }
+    }
+    spin_unlock(&scan->lock);
+
+    return status;
+}
+
+// Store registers seen outside of the scan, holding registers (function 3) or input registers
+// (function 4), into the image of the slave if it has one
+void modbus_scan_store(struct modbus_scan_t* const scan, uint8_t slave, uint8_t function, uint16_t start, uint16_t count, const uint16_t* const registers, struct modbus_scan_change_t* const change)
+{
+    change->count = 0;
+    if ((slave < 1) || (slave > MODBUS_MAX_UNIT_ID) || ((3 != function) && (4 != function)) || ((unsigned int)start + count > 65536))
+    {
+        return;
+    }
+
+    spin_lock(&scan->lock);
+    struct serial_modbus_image* image = scan->images[slave];
+    if (NULL != image)
+    {
+        change->slave = slave;
+        change->function = function;
+        find_change(image_registers(image, function), registers, start, count, change);
+    }
+    if (change->count > 0)
+    {
+        image_write(scan, image, change, &registers[change->start - start]);
+    }
+    spin_unlock(&scan->lock);
+}
+
+// Keep the image in line with what we just wrote, until the next scan confirms it
+void modbus_scan_write_through(struct modbus_scan_t* const scan, uint8_t slave, uint16_t start, uint16_t count, const uint16_t* const registers, struct modbus_scan_change_t* const change)
+{
+    modbus_scan_store(scan, slave, 3, start, count, registers, change);
+}
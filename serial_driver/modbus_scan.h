@@ -0,0 +1,78 @@
+#ifndef MODBUS_SCAN_H_
+#define MODBUS_SCAN_H_
+
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include "serial_modbus_ioctl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+#define MODBUS_MAX_UNIT_ID            247
+#define MODBUS_MAX_READ_REGISTERS     125  // Largest number of registers a single request may carry
+#define MODBUS_MAX_WRITE_REGISTERS    123
+#define MODBUS_MAX_RW_WRITE_REGISTERS 121  // Write block of a read/write multiple registers request
+#define MODBUS_MAX_READ_BITS          2000  // Coils or discrete inputs
+#define MODBUS_MAX_WRITE_BITS         1968
+
+struct vm_area_struct;
+
+struct modbus_scan_block_t
+{
+    struct serial_modbus_scan_block config;
+    ktime_t next_due;
+    bool valid;  // The image holds the result of the last scan of this block
+};
+
+// Registers whose value changed in the image, count is 0 if none did
+struct modbus_scan_change_t
+{
+    uint8_t slave;
+    uint8_t function;
+    uint16_t start;
+    uint16_t count;
+};
+
+/**
+ * Scan list and register images of one port.
+ *
+ * This module only keeps track of what is due and of the scanned values, running the actual
+ * transactions is up to the caller: modbus_scan_next() hands out the next due block and
+ * modbus_scan_complete() stores its result.
+ *
+ * Only slaves with scan blocks have an image. It is allocated with their first block and freed
+ * when the list is cleared.
+ */
+struct modbus_scan_t
+{
+    struct mutex images_lock;  // Serializes changes to the list with allocating, freeing and mapping images
+    spinlock_t lock;  // Protects everything below, including the image contents
+    struct modbus_scan_block_t blocks[SERIAL_MODBUS_MAX_SCAN_BLOCKS];
+    unsigned int n_blocks;
+    unsigned int generation;  // Incremented when the list is cleared, so stale results are dropped
+    struct serial_modbus_image* images[MODBUS_MAX_UNIT_ID + 1];  // Shadow of each scanned slave, mapped by user space
+};
+
+void modbus_scan_init(struct modbus_scan_t* const scan);
+void modbus_scan_cleanup(struct modbus_scan_t* const scan);
+bool modbus_scan_has_image(struct modbus_scan_t* const scan, uint8_t slave);
+int modbus_scan_map_image(struct modbus_scan_t* const scan, uint8_t slave, struct vm_area_struct* vma, unsigned long pgoff);
+int modbus_scan_add(struct modbus_scan_t* const scan, const struct serial_modbus_scan_block* const config);
+void modbus_scan_clear(struct modbus_scan_t* const scan);
+bool modbus_scan_next(struct modbus_scan_t* const scan, ktime_t now, struct serial_modbus_scan_block* const config, unsigned int* const index, unsigned int* const generation);
+ktime_t modbus_scan_next_due(struct modbus_scan_t* const scan);
+void modbus_scan_postpone(struct modbus_scan_t* const scan, unsigned int index, unsigned int generation, ktime_t until);
+void modbus_scan_complete(struct modbus_scan_t* const scan, unsigned int index, unsigned int generation, const uint16_t* const registers, bool success, struct modbus_scan_change_t* const change);
+int modbus_scan_read(struct modbus_scan_t* const scan, uint8_t slave, uint8_t function, uint16_t start, uint16_t count, uint16_t* const registers);
+void modbus_scan_store(struct modbus_scan_t* const scan, uint8_t slave, uint8_t function, uint16_t start, uint16_t count, const uint16_t* const registers, struct modbus_scan_change_t* const change);
+void modbus_scan_write_through(struct modbus_scan_t* const scan, uint8_t slave, uint16_t start, uint16_t count, const uint16_t* const registers, struct modbus_scan_change_t* const change);
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#endif  // MODBUS_SCAN_H_
@@ -0,0 +1,185 @@
+#include "modbus_sched.h"
+
+#include <linux/errno.h>
+#include <linux/limits.h>
+#include <linux/math64.h>
+#include <linux/minmax.h>
+
+#define RETURN_IF(x, y) \
+    if ((x)) return (y)
+
+void modbus_sched_init(struct modbus_sched_t* const sched, uint32_t aging_ms)
+{
+    sched->aging_ms = max_t(uint32_t, aging_ms, 1);
+    for (unsigned int priority = 0; priority < SERIAL_MODBUS_PRIORITY_COUNT; priority++)
+    {
+        INIT_LIST_HEAD(&sched->active[priority]);
+        sched->waiting_since[priority] = 0;
+    }
+}
+
+int modbus_sched_flow_init(struct modbus_flow_t* const flow, unsigned int priority, uint32_t quantum_us)
+{
+    RETURN_IF(priority >= SERIAL_MODBUS_PRIORITY_COUNT, -EINVAL);
+    RETURN_IF(0 == quantum_us, -EINVAL);
+
+    INIT_LIST_HEAD(&flow->requests);
+    INIT_LIST_HEAD(&flow->active);
+    flow->priority = priority;
+    flow->quantum_us = quantum_us;
+    flow->deficit_us = 0;
+
+    return 0;
+}
+
+void modbus_sched_enqueue(struct modbus_sched_t* const sched, struct modbus_flow_t* const flow, struct list_head* const node, ktime_t now)
+{
+    list_add_tail(node, &flow->requests);
+    if (!list_empty(&flow->active))
+    {
+        return;
+    }
+
+    // Neither a class nor a flow saves up bus time while idle, only debts are kept
+    struct list_head* const active = &sched->active[flow->priority];
+    if (list_empty(active))
+    {
+        sched->waiting_since[flow->priority] = now;
+    }
+    flow->deficit_us = min_t(s64, flow->deficit_us, 0);
+    list_add_tail(&flow->active, active);
+}
+
+// Put back a request that was just dequeued and has more to do. It goes before whatever its flow
+// queued since, and the flow keeps its turn and the bus time it has left, so a job that takes the
+// bus several times is charged each time like any other request of its flow.
+void modbus_sched_requeue(struct modbus_sched_t* const sched, struct modbus_flow_t* const flow, struct list_head* const node, ktime_t now)
+{
+    list_add(node, &flow->requests);
+    if (!list_empty(&flow->active))
+    {
+        return;
+    }
+
+    struct list_head* const active = &sched->active[flow->priority];
+    if (list_empty(active))
+    {
+        sched->waiting_since[flow->priority] = now;
+    }
+    list_add(&flow->active, active);
+}
+
+// Class that work waiting since the given time competes in
+static unsigned int modbus_sched_aged(const struct modbus_sched_t* const sched, unsigned int priority, ktime_t since, ktime_t now)
+{
+    const s64 steps = div_s64(ktime_ms_delta(now, since), sched->aging_ms);
+
+    return (steps >= priority) ? 0 : priority - max_t(s64, steps, 0);
+}
+
+// The most urgent class after aging goes first, the one waiting longest on a tie
+static bool modbus_sched_goes_first(const struct modbus_sched_t* const sched, unsigned int a, ktime_t a_since, unsigned int b, ktime_t b_since, ktime_t now)
+{
+    const unsigned int a_aged = modbus_sched_aged(sched, a, a_since, now);
+    const unsigned int b_aged = modbus_sched_aged(sched, b, b_since, now);
+
+    return (a_aged < b_aged) || ((a_aged == b_aged) && (a_since <= b_since));
+}
+
+// The flow at the front of a class with bus time left, handing out quanta as turns go by
+static struct modbus_flow_t* modbus_sched_next_flow(struct list_head* const active)
+{
+    struct modbus_flow_t* flow;
+
+    // Skip the rounds in which no flow would get to go, a long transaction can leave a debt of
+    // many quanta. Every flow gets the quantum of each skipped round.
+    s64 rounds = S64_MAX;
+    list_for_each_entry(flow, active, active)
+    {
+        rounds = min(rounds, div_s64(-flow->deficit_us, flow->quantum_us));
+    }
+    if (rounds > 0)
+    {
+        list_for_each_entry(flow, active, active)
+        {
+            flow->deficit_us += rounds * flow->quantum_us;
+        }
+    }
+
+    // At most one more round
+    flow = list_first_entry(active, struct modbus_flow_t, active);
+    while (flow->deficit_us <= 0)
+    {
+        flow->deficit_us += flow->quantum_us;
+        list_move_tail(&flow->active, active);
+        flow = list_first_entry(active, struct modbus_flow_t, active);
+    }
+
+    return flow;
+}
+
+struct list_head* modbus_sched_dequeue(struct modbus_sched_t* const sched, ktime_t background_due, ktime_t now, struct modbus_flow_t** const flow)
+{
+    unsigned int next = SERIAL_MODBUS_PRIORITY_COUNT;
+    for (unsigned int priority = 0; priority < SERIAL_MODBUS_PRIORITY_COUNT; priority++)
+    {
+        if (!list_empty(&sched->active[priority]) &&
+            ((SERIAL_MODBUS_PRIORITY_COUNT == next) ||
+             modbus_sched_goes_first(sched, priority, sched->waiting_since[priority], next, sched->waiting_since[next], now)))
+        {
+            next = priority;
+        }
+    }
+    RETURN_IF(SERIAL_MODBUS_PRIORITY_COUNT == next, NULL);
+
+    // Background work of the caller competes in the background class
+    RETURN_IF((background_due <= now) &&
+                  !modbus_sched_goes_first(sched, next, sched->waiting_since[next], SERIAL_MODBUS_PRIORITY_BACKGROUND, background_due, now),
+              NULL);
+
+    *flow = modbus_sched_next_flow(&sched->active[next]);
+    struct list_head* const node = (*flow)->requests.next;
+    list_del_init(node);
+    if (list_empty(&(*flow)->requests))
+    {
+        list_del_init(&(*flow)->active);
+    }
+    sched->waiting_since[next] = now;
+
+    return node;
+}
+
+void modbus_sched_charge(struct modbus_flow_t* const flow, s64 airtime_us)
+{
+    flow->deficit_us -= max_t(s64, airtime_us, 0);
+}
+
+bool modbus_sched_empty(struct modbus_sched_t* const sched)
+{
+    // Also used as a lockless hint
+    for (unsigned int priority = 0; priority < SERIAL_MODBUS_PRIORITY_COUNT; priority++)
+    {
+        RETURN_IF(!list_empty_careful(&sched->active[priority]), false);
+    }
+
+    return true;
+}
+
+void modbus_sched_flush_flow(struct modbus_flow_t* const flow, struct list_head* const requests)
+{
+    list_splice_tail_init(&flow->requests, requests);
+    list_del_init(&flow->active);
+}
+
+void modbus_sched_flush(struct modbus_sched_t* const sched, struct list_head* const requests)
+{
+    struct modbus_flow_t *flow, *tmp;
+
+    for (unsigned int priority = 0; priority < SERIAL_MODBUS_PRIORITY_COUNT; priority++)
+    {
+        list_for_each_entry_safe(flow, tmp, &sched->active[priority], active)
+        {
+            modbus_sched_flush_flow(flow, requests);
+        }
+    }
+}
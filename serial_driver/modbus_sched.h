@@ -0,0 +1,53 @@
+#ifndef MODBUS_SCHED_H_
+#define MODBUS_SCHED_H_
+
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/types.h>
+
+#include "serial_modbus_ioctl.h"  // SERIAL_MODBUS_PRIORITY_COUNT
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+// Requests of one client in one priority class, oldest first
+struct modbus_flow_t
+{
+    struct list_head requests;
+    struct list_head active;  // In its class while it has requests
+    unsigned int priority;
+    uint32_t quantum_us;  // Bus time granted each round
+    s64 deficit_us;       // Bus time left in the current round, negative when overdrawn
+};
+
+/**
+ * Order in which queued requests get the bus. Classes are served most urgent first, a class that
+ * waits moves up one class every aging_ms. Within a class, flows take turns by deficit round robin
+ * on the bus time their requests actually used, so a client gets its share however many requests
+ * it queues and however long they take.
+ *
+ * Nothing is locked here, the caller serializes every call.
+ */
+struct modbus_sched_t
+{
+    uint32_t aging_ms;
+    struct list_head active[SERIAL_MODBUS_PRIORITY_COUNT];  // Flows with requests, in turn order
+    ktime_t waiting_since[SERIAL_MODBUS_PRIORITY_COUNT];    // Last time the class got the bus
+};
+
+void modbus_sched_init(struct modbus_sched_t* const sched, uint32_t aging_ms);
+int modbus_sched_flow_init(struct modbus_flow_t* const flow, unsigned int priority, uint32_t quantum_us);
+void modbus_sched_enqueue(struct modbus_sched_t* const sched, struct modbus_flow_t* const flow, struct list_head* const node, ktime_t now);
+void modbus_sched_requeue(struct modbus_sched_t* const sched, struct modbus_flow_t* const flow, struct list_head* const node, ktime_t now);
+struct list_head* modbus_sched_dequeue(struct modbus_sched_t* const sched, ktime_t background_due, ktime_t now, struct modbus_flow_t** const flow);
+void modbus_sched_charge(struct modbus_flow_t* const flow, s64 airtime_us);
+bool modbus_sched_empty(struct modbus_sched_t* const sched);
+void modbus_sched_flush_flow(struct modbus_flow_t* const flow, struct list_head* const requests);
+void modbus_sched_flush(struct modbus_sched_t* const sched, struct list_head* const requests);
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#endif  // MODBUS_SCHED_H_
@@ -0,0 +1,202 @@
+#include "modbus_sniff.h"
+
+#include <linux/string.h>
+
+#include "modbus_crc.h"
+
+#define RETURN_IF(x, y) \
+    if ((x)) return (y)
+
+#define MODBUS_RTU_MIN_FRAME 4  // Address, function and CRC
+
+static uint16_t get_u16(const uint8_t* data)
+{
+    return ((uint16_t)data[0] << 8) | data[1];
+}
+
+static bool crc_ok(const uint8_t* data, size_t length)
+{
+    const uint16_t crc = modbus_crc_update(MODBUS_CRC_INIT, data, length - 2);
+    return (data[length - 2] == (crc & 0xFF)) && (data[length - 1] == (crc >> 8));
+}
+
+// Length of the request starting data, 0 if it cannot be one or is not known yet
+static size_t request_length(const uint8_t* data, size_t length)
+{
+    switch (data[1])
+    {
+        case 1:
+        case 2:
+        case 3:
+        case 4:
+        case 5:
+        case 6:
+            return 8;
+        case 15:
+        case 16:
+            return (length > 6) ? 9 + data[6] : 0;
+        case 23:
+            return (length > 10) ? 13 + data[10] : 0;
+        default:
+            return 0;
+    }
+}
+
+static size_t response_length(const uint8_t* data, size_t length)
+{
+    RETURN_IF(data[1] & 0x80, 5);
+
+    switch (data[1])
+    {
+        case 1:
+        case 2:
+        case 3:
+        case 4:
+        case 23:
+            return 5 + data[2];
+        case 5:
+        case 6:
+        case 15:
+        case 16:
+            return 8;
+        default:
+            return 0;
+    }
+}
+
+static void parse_registers(const uint8_t* data, uint16_t count, uint16_t* registers)
+{
+    for (unsigned int i = 0; i < count; i++)
+    {
+        registers[i] = get_u16(&data[2 * i]);
+    }
+}
+
+// Remember a request, the registers it writes included
+static void parse_request(struct modbus_sniff_pair_t* const request, const uint8_t* data)
+{
+    request->slave = data[0];
+    request->function = data[1];
+    request->exception = 0;
+    request->address = get_u16(&data[2]);
+    request->count = get_u16(&data[4]);
+    request->n_registers = 0;
+
+    switch (request->function)
+    {
+        case 5:
+            request->count = 1;
+            break;
+        case 6:
+            request->count = 1;
+            request->n_registers = 1;
+            request->registers[0] = get_u16(&data[4]);
+            break;
+        case 16:
+            if ((request->count <= MODBUS_MAX_WRITE_REGISTERS) && (data[6] == 2 * request->count))
+            {
+                request->n_registers = request->count;
+                parse_registers(&data[7], request->count, request->registers);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Complete the pending request with its response, false if the response does not fit it
+static bool parse_response(const struct modbus_sniff_pair_t* const request, const uint8_t* data, struct modbus_sniff_pair_t* const pair)
+{
+    *pair = *request;
+    if (data[1] & 0x80)
+    {
+        pair->exception = data[2];
+        pair->n_registers = 0;
+        return true;
+    }
+
+    switch (request->function)
+    {
+        case 1:
+        case 2:
+            return data[2] == (request->count + 7) / 8;
+        case 3:
+        case 4:
+        case 23:
+            RETURN_IF((request->count > MODBUS_MAX_READ_REGISTERS) || (data[2] != 2 * request->count), false);
+            pair->n_registers = request->count;
+            parse_registers(&data[3], request->count, pair->registers);
+            return true;
+        case 6:
+            return (get_u16(&data[2]) == request->address) && (get_u16(&data[4]) == request->registers[0]);
+        case 5:
+            return get_u16(&data[2]) == request->address;
+        default:
+            // 15 and 16 echo address and count
+            return (get_u16(&data[2]) == request->address) && (get_u16(&data[4]) == request->count);
+    }
+}
+
+void modbus_sniff_init(struct modbus_sniff_t* const sniff)
+{
+    memset(sniff, 0, sizeof(*sniff));
+}
+
+// Forget the request in flight, the counters stay
+void modbus_sniff_reset(struct modbus_sniff_t* const sniff)
+{
+    sniff->pending = false;
+}
+
+/**
+ * Decode the frame at the start of data. Returns its length, or 0 if no valid frame starts there,
+ * in which case the rest of the data cannot be delimited either. A response completing a request
+ * sets paired and fills pair.
+ */
+size_t modbus_sniff_decode(struct modbus_sniff_t* const sniff, const uint8_t* data, size_t length, struct modbus_sniff_pair_t* const pair, bool* const paired)
+{
+    *paired = false;
+    if (length < MODBUS_RTU_MIN_FRAME)
+    {
+        sniff->garbage_bytes += length;
+        return 0;
+    }
+
+    // The response of the slave a request was sent to, or the next request
+    size_t n_bytes = 0;
+    if (sniff->pending && (data[0] == sniff->request.slave) && ((data[1] & 0x7F) == sniff->request.function))
+    {
+        n_bytes = response_length(data, length);
+        if ((n_bytes >= MODBUS_RTU_MIN_FRAME) && (n_bytes <= length) && crc_ok(data, n_bytes) &&
+            parse_response(&sniff->request, data, pair))
+        {
+            sniff->pending = false;
+            sniff->frames++;
+            sniff->pairs++;
+            *paired = true;
+            return n_bytes;
+        }
+    }
+
+    const size_t request_bytes = request_length(data, length);
+    if ((request_bytes >= MODBUS_RTU_MIN_FRAME) && (request_bytes <= length) && crc_ok(data, request_bytes))
+    {
+        if (sniff->pending)
+        {
+            sniff->unanswered++;
+        }
+        parse_request(&sniff->request, data);
+        sniff->pending = (0 != sniff->request.slave);  // Broadcasts get no response
+        sniff->frames++;
+        return request_bytes;
+    }
+
+    // Whatever was expected, it did not arrive intact
+    if (((n_bytes >= MODBUS_RTU_MIN_FRAME) && (n_bytes <= length)) || ((request_bytes >= MODBUS_RTU_MIN_FRAME) && (request_bytes <= length)))
+    {
+        sniff->crc_errors++;
+    }
+    sniff->pending = false;
+    sniff->garbage_bytes += length;
+    return 0;
+}
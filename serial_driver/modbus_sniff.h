@@ -0,0 +1,48 @@
+#ifndef MODBUS_SNIFF_H_
+#define MODBUS_SNIFF_H_
+
+#include <linux/types.h>
+
+#include "modbus_scan.h"  // MODBUS_MAX_READ_REGISTERS
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+// A request seen on the bus together with the response that answered it
+struct modbus_sniff_pair_t
+{
+    uint8_t slave;
+    uint8_t function;   // Without the exception bit
+    uint8_t exception;  // Exception code, 0 for a normal response
+    uint16_t address;   // Read address for function 23
+    uint16_t count;     // Registers or bits, read count for function 23
+    uint16_t n_registers;  // Read by functions 3, 4 and 23, or written by 6 and 16, 0 otherwise
+    uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+};
+
+/**
+ * Decoder of the traffic between another master and its slaves. Frames are recognized from their
+ * function code and checked against their CRC, a response is only accepted right after a request
+ * it matches.
+ */
+struct modbus_sniff_t
+{
+    bool pending;  // request waits for its response
+    struct modbus_sniff_pair_t request;
+    uint32_t frames;
+    uint32_t pairs;
+    uint32_t crc_errors;
+    uint32_t unanswered;     // Requests followed by another request
+    uint32_t garbage_bytes;  // Bytes that did not start a valid frame
+};
+
+void modbus_sniff_init(struct modbus_sniff_t* const sniff);
+void modbus_sniff_reset(struct modbus_sniff_t* const sniff);
+size_t modbus_sniff_decode(struct modbus_sniff_t* const sniff, const uint8_t* data, size_t length, struct modbus_sniff_pair_t* const pair, bool* const paired);
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#endif  // MODBUS_SNIFF_H_
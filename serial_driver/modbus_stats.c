@@ -0,0 +1,107 @@
+#include "modbus_stats.h"
+
+#include <linux/bitops.h>
+#include <linux/errno.h>
+#include <linux/minmax.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#define RETURN_IF(x, y) \
+    if ((x)) return (y)
+
+int modbus_stats_init(struct modbus_stats_t* const stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    spin_lock_init(&stats->lock);
+    stats->since = ktime_get();
+
+    // Too large to live in the device itself
+    stats->slaves = vzalloc((MODBUS_MAX_UNIT_ID + 1) * sizeof(struct modbus_stats_counters_t));
+    RETURN_IF(NULL == stats->slaves, -ENOMEM);
+
+    return 0;
+}
+
+void modbus_stats_cleanup(struct modbus_stats_t* const stats)
+{
+    vfree(stats->slaves);
+    stats->slaves = NULL;
+}
+
+void modbus_stats_reset(struct modbus_stats_t* const stats)
+{
+    spin_lock(&stats->lock);
+    memset(&stats->port, 0, sizeof(stats->port));
+    memset(stats->slaves, 0, (MODBUS_MAX_UNIT_ID + 1) * sizeof(struct modbus_stats_counters_t));
+    stats->since = ktime_get();
+    spin_unlock(&stats->lock);
+}
+
+static void modbus_stats_latency(struct modbus_stats_counters_t* const counters, enum modbus_stats_latency_t latency, s64 us)
+{
+    const unsigned int bucket = (us > 0) ? min_t(unsigned int, fls64(us), MODBUS_STATS_BUCKETS - 1) : 0;
+    counters->histograms[latency][bucket]++;
+}
+
+static void modbus_stats_add(struct modbus_stats_counters_t* const counters, const struct modbus_stats_sample_t* const sample)
+{
+    counters->transactions++;
+    counters->tx_bytes += sample->tx_bytes;
+    counters->rx_bytes += sample->rx_bytes;
+
+    switch (sample->outcome)
+    {
+        case MODBUS_STATS_OK:
+            break;
+        case MODBUS_STATS_TIMEOUT:
+            counters->timeouts++;
+            break;
+        case MODBUS_STATS_CRC_ERROR:
+            counters->crc_errors++;
+            break;
+        case MODBUS_STATS_EXCEPTION:
+            counters->exceptions++;
+            break;
+        default:
+            counters->errors++;
+            break;
+    }
+
+    if (sample->tx_us >= 0)
+    {
+        modbus_stats_latency(counters, MODBUS_STATS_TX, sample->tx_us);
+    }
+    if (sample->first_byte_us >= 0)
+    {
+        modbus_stats_latency(counters, MODBUS_STATS_FIRST_BYTE, sample->first_byte_us);
+    }
+    modbus_stats_latency(counters, MODBUS_STATS_TOTAL, sample->total_us);
+}
+
+void modbus_stats_transaction(struct modbus_stats_t* const stats, const struct modbus_stats_sample_t* const sample)
+{
+    if (sample->slave > MODBUS_MAX_UNIT_ID)
+    {
+        return;
+    }
+
+    spin_lock(&stats->lock);
+    modbus_stats_add(&stats->port, sample);
+    modbus_stats_add(&stats->slaves[sample->slave], sample);
+    spin_unlock(&stats->lock);
+}
+
+void modbus_stats_queue_wait(struct modbus_stats_t* const stats, s64 wait_us)
+{
+    spin_lock(&stats->lock);
+    stats->port.queue_wait_us += max_t(s64, wait_us, 0);
+    modbus_stats_latency(&stats->port, MODBUS_STATS_QUEUE_WAIT, wait_us);
+    spin_unlock(&stats->lock);
+}
+
+void modbus_stats_fifo_overrun(struct modbus_stats_t* const stats, unsigned int dropped)
+{
+    spin_lock(&stats->lock);
+    stats->port.fifo_overruns += dropped;
+    spin_unlock(&stats->lock);
+}
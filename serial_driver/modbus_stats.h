@@ -0,0 +1,85 @@
+#ifndef MODBUS_STATS_H_
+#define MODBUS_STATS_H_
+
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include "modbus_scan.h"  // MODBUS_MAX_UNIT_ID
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+// Latency histograms have log2 buckets: bucket 0 counts durations under 1 us, bucket i those in
+// [2^(i-1), 2^i) us, and the last one everything from about 4 s on.
+#define MODBUS_STATS_BUCKETS 24
+
+enum modbus_stats_latency_t
+{
+    MODBUS_STATS_QUEUE_WAIT,  // Request queued until the bus thread picks it up, per port only
+    MODBUS_STATS_TX,          // Transaction start until its request is handed to the serial port
+    MODBUS_STATS_FIRST_BYTE,  // End of the request on the line until the first byte of the response
+    MODBUS_STATS_TOTAL,       // Whole transaction
+    MODBUS_STATS_LATENCIES,
+};
+
+enum modbus_stats_outcome_t
+{
+    MODBUS_STATS_OK,
+    MODBUS_STATS_TIMEOUT,
+    MODBUS_STATS_CRC_ERROR,
+    MODBUS_STATS_EXCEPTION,
+    MODBUS_STATS_ERROR,  // Any other failure
+};
+
+struct modbus_stats_counters_t
+{
+    uint64_t transactions;
+    uint64_t tx_bytes;
+    uint64_t rx_bytes;
+    uint64_t timeouts;
+    uint64_t crc_errors;
+    uint64_t exceptions;
+    uint64_t errors;
+    uint64_t fifo_overruns;  // Received bytes dropped because the fifo was full, per port only
+    uint64_t queue_wait_us;  // Summed over all requests
+    uint64_t histograms[MODBUS_STATS_LATENCIES][MODBUS_STATS_BUCKETS];
+};
+
+// One transaction, as seen by the bus thread
+struct modbus_stats_sample_t
+{
+    uint8_t slave;
+    enum modbus_stats_outcome_t outcome;
+    uint32_t tx_bytes;
+    uint32_t rx_bytes;
+    s64 tx_us;          // Negative if nothing was sent
+    s64 first_byte_us;  // Negative if nothing was received
+    s64 total_us;
+};
+
+/**
+ * Bus performance counters of a port, as a whole and per slave, kept since the last reset. Broadcasts
+ * count as unit 0.
+ */
+struct modbus_stats_t
+{
+    spinlock_t lock;  // Protects everything below
+    ktime_t since;    // Last reset
+    struct modbus_stats_counters_t port;
+    struct modbus_stats_counters_t* slaves;  // MODBUS_MAX_UNIT_ID + 1 of them
+};
+
+int modbus_stats_init(struct modbus_stats_t* const stats);
+void modbus_stats_cleanup(struct modbus_stats_t* const stats);
+void modbus_stats_reset(struct modbus_stats_t* const stats);
+void modbus_stats_transaction(struct modbus_stats_t* const stats, const struct modbus_stats_sample_t* const sample);
+void modbus_stats_queue_wait(struct modbus_stats_t* const stats, s64 wait_us);
+void modbus_stats_fifo_overrun(struct modbus_stats_t* const stats, unsigned int dropped);
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#endif  // MODBUS_STATS_H_
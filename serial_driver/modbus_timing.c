@@ -0,0 +1,53 @@
+#include "modbus_timing.h"
+
+#include <linux/errno.h>
+#include <linux/log2.h>
+#include <linux/minmax.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#define RETURN_IF(x, y) \
+    if ((x)) return (y)
+
+int modbus_timing_init(struct modbus_timing_t* const timing, unsigned int size)
+{
+    memset(timing, 0, sizeof(*timing));
+    spin_lock_init(&timing->lock);
+    RETURN_IF(!is_power_of_2(size), -EINVAL);
+
+    timing->records = vzalloc(size * sizeof(struct serial_modbus_timing));
+    RETURN_IF(NULL == timing->records, -ENOMEM);
+    timing->size = size;
+
+    return 0;
+}
+
+void modbus_timing_cleanup(struct modbus_timing_t* const timing)
+{
+    vfree(timing->records);
+    timing->records = NULL;
+    timing->size = 0;
+}
+
+void modbus_timing_record(struct modbus_timing_t* const timing, const struct serial_modbus_timing* const record)
+{
+    spin_lock(&timing->lock);
+    struct serial_modbus_timing* slot = &timing->records[timing->next_sequence & (timing->size - 1)];
+    *slot = *record;
+    slot->sequence = timing->next_sequence++;
+    spin_unlock(&timing->lock);
+}
+
+// Copies the records, oldest first, to an array of size records. Returns how many there were.
+unsigned int modbus_timing_snapshot(struct modbus_timing_t* const timing, struct serial_modbus_timing* const records)
+{
+    spin_lock(&timing->lock);
+    const unsigned int n_records = min_t(uint64_t, timing->next_sequence, timing->size);
+    const unsigned int first = (timing->next_sequence - n_records) & (timing->size - 1);
+    const unsigned int n_head = min(n_records, timing->size - first);
+    memcpy(records, &timing->records[first], n_head * sizeof(struct serial_modbus_timing));
+    memcpy(records + n_head, timing->records, (n_records - n_head) * sizeof(struct serial_modbus_timing));
+    spin_unlock(&timing->lock);
+
+    return n_records;
+}
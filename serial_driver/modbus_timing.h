@@ -0,0 +1,34 @@
+#ifndef MODBUS_TIMING_H_
+#define MODBUS_TIMING_H_
+
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include "serial_modbus_ioctl.h"  // struct serial_modbus_timing
+
+#ifdef __cplusplus
+extern "C" {
+#endif  // __cplusplus
+
+/**
+ * Ring of the timings of the last transactions of a port. The bus thread adds one record per
+ * transaction, readers take a snapshot of the whole ring, so the bus only ever waits for a copy.
+ */
+struct modbus_timing_t
+{
+    spinlock_t lock;  // Protects everything below
+    struct serial_modbus_timing* records;
+    unsigned int size;  // A power of two
+    uint64_t next_sequence;
+};
+
+int modbus_timing_init(struct modbus_timing_t* const timing, unsigned int size);
+void modbus_timing_cleanup(struct modbus_timing_t* const timing);
+void modbus_timing_record(struct modbus_timing_t* const timing, const struct serial_modbus_timing* const record);
+unsigned int modbus_timing_snapshot(struct modbus_timing_t* const timing, struct serial_modbus_timing* const records);
+
+#ifdef __cplusplus
+}
+#endif  // __cplusplus
+
+#endif  // MODBUS_TIMING_H_
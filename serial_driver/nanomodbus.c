@@ -148,6 +148,10 @@ static nmbs_error recv(nmbs_t* nmbs, uint16_t count)
 {
     if (nmbs->msg.complete)
     {
+        // Everything was received already, only hand out what actually arrived
+        if (nmbs->msg.buf_idx + count > nmbs->msg.length)
+            return NMBS_ERROR_INVALID_RESPONSE;
+
         return NMBS_ERROR_NONE;
     }
 
@@ -205,6 +209,7 @@ static void msg_state_reset(nmbs_t* nmbs)
     nmbs->msg.broadcast = false;
     nmbs->msg.ignored = false;
     nmbs->msg.complete = false;
+    nmbs->msg.length = 0;
 }
 
 #ifndef NMBS_CLIENT_DISABLED
@@ -219,12 +224,46 @@ static void msg_state_req(nmbs_t* nmbs, uint8_t fc)
     flush(nmbs);
 
     msg_state_reset(nmbs);
+    nmbs->expected_res_length = 0;
     nmbs->msg.unit_id = nmbs->dest_address_rtu;
     nmbs->msg.fc = fc;
     nmbs->msg.transaction_id = nmbs->current_tid;
     if (nmbs->msg.unit_id == 0 && nmbs->platform.transport == NMBS_TRANSPORT_RTU)
         nmbs->msg.broadcast = true;
 }
+
+static void set_expected_res_length(nmbs_t* nmbs, uint16_t pdu_length)
+{
+    // Unit ID + PDU + CRC. Only RTU responses are read in one go.
+    if (nmbs->platform.transport == NMBS_TRANSPORT_RTU && nmbs->platform.read_response)
+        nmbs->expected_res_length = 1 + pdu_length + 2;
+}
+
+static nmbs_error recv_res_frame(nmbs_t* nmbs, int32_t byte_timeout_ms, bool* first_byte_received)
+{
+    uint16_t count = nmbs->expected_res_length;
+    nmbs->expected_res_length = 0;
+
+    // The whole frame has to arrive within the response timeout plus one byte timeout
+    int32_t timeout_ms = -1;
+    if (nmbs->read_timeout_ms >= 0 && byte_timeout_ms >= 0)
+        timeout_ms = nmbs->read_timeout_ms + byte_timeout_ms;
+
+    int32_t ret = nmbs->platform.read_response(nmbs->msg.buf, count, timeout_ms, nmbs->platform.arg);
+    if (ret < 0 || ret > count)
+        return NMBS_ERROR_TRANSPORT;
+
+    if (ret > 0)
+        *first_byte_received = true;
+
+    // Either the full response or a complete exception response
+    if (ret < count && !(ret == 5 && (nmbs->msg.buf[1] & 0x80)))
+        return NMBS_ERROR_TIMEOUT;
+
+    nmbs->msg.length = ret;
+    nmbs->msg.complete = true;
+    return NMBS_ERROR_NONE;
+}
 #endif
 
 nmbs_error nmbs_create(nmbs_t* nmbs, const nmbs_platform_conf* platform_conf)
@@ -334,6 +373,19 @@ static nmbs_error recv_msg_header(nmbs_t* nmbs, bool* first_byte_received)
 
     if (nmbs->platform.transport == NMBS_TRANSPORT_RTU)
     {
+#ifndef NMBS_CLIENT_DISABLED
+        if (nmbs->expected_res_length)
+        {
+            // Receive the whole response at once, the fields below are then parsed from the buffer
+            nmbs_error err = recv_res_frame(nmbs, old_byte_timeout, first_byte_received);
+            if (err != NMBS_ERROR_NONE)
+            {
+                nmbs->byte_timeout_ms = old_byte_timeout;
+                return err;
+            }
+        }
+#endif
+
         nmbs_error err = recv(nmbs, 1);
 
         nmbs->byte_timeout_ms = old_byte_timeout;
@@ -389,6 +441,7 @@ static nmbs_error recv_msg_header(nmbs_t* nmbs, bool* first_byte_received)
         if (protocol_id != 0)
             return NMBS_ERROR_INVALID_TCP_MBAP;
 
+        nmbs->msg.length = nmbs->msg.buf_idx + length - 2;
         nmbs->msg.complete = true;
     }
 
@@ -553,7 +606,7 @@ static void put_req_header(nmbs_t* nmbs, uint16_t data_length)
 #if !defined(NMBS_CLIENT_DISABLED) ||  \
     (!defined(NMBS_SERVER_DISABLED) && \
      (!defined(NMBS_SERVER_READ_COILS_DISABLED) || !defined(NMBS_SERVER_READ_DISCRETE_INPUTS_DISABLED)))
-static nmbs_error recv_read_discrete_res(nmbs_t* nmbs, nmbs_bitfield values)
+static nmbs_error recv_read_discrete_res(nmbs_t* nmbs, uint16_t quantity, nmbs_bitfield values)
 {
     nmbs_error err = recv_res_header(nmbs);
     if (err != NMBS_ERROR_NONE)
@@ -566,28 +619,28 @@ static nmbs_error recv_read_discrete_res(nmbs_t* nmbs, nmbs_bitfield values)
     uint8_t coils_bytes = get_1(nmbs);
     NMBS_DEBUG_PRINT("b %d\t", coils_bytes);
 
-    if (coils_bytes > 250)
-    {
+    // values only has room for the requested quantity
+    if (coils_bytes != (quantity + 7) / 8)
         return NMBS_ERROR_INVALID_RESPONSE;
-    }
 
     err = recv(nmbs, coils_bytes);
     if (err != NMBS_ERROR_NONE)
         return err;
 
+    const uint8_t* coils = get_n(nmbs, coils_bytes);
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
     NMBS_DEBUG_PRINT("coils ");
     for (int i = 0; i < coils_bytes; i++)
     {
-        uint8_t coil = get_1(nmbs);
         if (values)
-            values[i] = coil;
-        NMBS_DEBUG_PRINT("%d ", coil);
+            values[i] = coils[i];
+        NMBS_DEBUG_PRINT("%d ", coils[i]);
     }
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
-
     return NMBS_ERROR_NONE;
 }
 #endif
@@ -608,29 +661,29 @@ static nmbs_error recv_read_registers_res(nmbs_t* nmbs, uint16_t quantity, uint1
     uint8_t registers_bytes = get_1(nmbs);
     NMBS_DEBUG_PRINT("b %d\t", registers_bytes);
 
-    if (registers_bytes > 250)
+    // registers only has room for the requested quantity
+    if (registers_bytes != quantity * 2)
         return NMBS_ERROR_INVALID_RESPONSE;
 
     err = recv(nmbs, registers_bytes);
     if (err != NMBS_ERROR_NONE)
         return err;
 
+    const uint8_t* data = get_n(nmbs, registers_bytes);
+
+    err = recv_msg_footer(nmbs);
+    if (err != NMBS_ERROR_NONE)
+        return err;
+
     NMBS_DEBUG_PRINT("regs ");
-    for (int i = 0; i < registers_bytes / 2; i++)
+    for (int i = 0; i < quantity; i++)
     {
-        uint16_t reg = get_2(nmbs);
+        const uint16_t reg = ((uint16_t)data[2 * i]) << 8 | (uint16_t)data[2 * i + 1];
         if (registers)
             registers[i] = reg;
         NMBS_DEBUG_PRINT("%d ", reg);
     }
 
-    err = recv_msg_footer(nmbs);
-    if (err != NMBS_ERROR_NONE)
-        return err;
-
-    if (registers_bytes != quantity * 2)
-        return NMBS_ERROR_INVALID_RESPONSE;
-
     return NMBS_ERROR_NONE;
 }
 #endif
@@ -990,7 +1043,7 @@ static nmbs_error handle_read_discrete(nmbs_t* nmbs,
     }
     else
     {
-        return recv_read_discrete_res(nmbs, NULL);
+        return recv_read_discrete_res(nmbs, quantity, NULL);
     }
 
     return NMBS_ERROR_NONE;
@@ -2092,7 +2145,8 @@ static nmbs_error read_discrete(nmbs_t* nmbs, uint8_t fc, uint16_t address, uint
     if (err != NMBS_ERROR_NONE)
         return err;
 
-    return recv_read_discrete_res(nmbs, values);
+    set_expected_res_length(nmbs, 2 + (quantity + 7) / 8);
+    return recv_read_discrete_res(nmbs, quantity, values);
 }
 
 nmbs_error nmbs_read_coils(nmbs_t* nmbs, uint16_t address, uint16_t quantity, nmbs_bitfield coils_out)
@@ -2125,6 +2179,7 @@ static nmbs_error read_registers(nmbs_t* nmbs, uint8_t fc, uint16_t address, uin
     if (err != NMBS_ERROR_NONE)
         return err;
 
+    set_expected_res_length(nmbs, 2 + quantity * 2);
     return recv_read_registers_res(nmbs, quantity, registers);
 }
 
@@ -2155,7 +2210,10 @@ nmbs_error nmbs_write_single_coil(nmbs_t* nmbs, uint16_t address, bool value)
         return err;
 
     if (!nmbs->msg.broadcast)
+    {
+        set_expected_res_length(nmbs, 5);
         return recv_write_single_coil_res(nmbs, address, value_req);
+    }
 
     return NMBS_ERROR_NONE;
 }
@@ -2175,7 +2233,10 @@ nmbs_error nmbs_write_single_register(nmbs_t* nmbs, uint16_t address, uint16_t v
         return err;
 
     if (!nmbs->msg.broadcast)
+    {
+        set_expected_res_length(nmbs, 5);
         return recv_write_single_register_res(nmbs, address, value);
+    }
 
     return NMBS_ERROR_NONE;
 }
@@ -2210,7 +2271,10 @@ nmbs_error nmbs_write_multiple_coils(nmbs_t* nmbs, uint16_t address, uint16_t qu
         return err;
 
     if (!nmbs->msg.broadcast)
+    {
+        set_expected_res_length(nmbs, 5);
         return recv_write_multiple_coils_res(nmbs, address, quantity);
+    }
 
     return NMBS_ERROR_NONE;
 }
@@ -2245,7 +2309,10 @@ nmbs_error nmbs_write_multiple_registers(nmbs_t* nmbs, uint16_t address, uint16_
         return err;
 
     if (!nmbs->msg.broadcast)
+    {
+        set_expected_res_length(nmbs, 5);
         return recv_write_single_register_res(nmbs, address, quantity);
+    }
 
     return NMBS_ERROR_NONE;
 }
@@ -2358,6 +2425,7 @@ nmbs_error nmbs_read_write_registers(nmbs_t* nmbs, uint16_t read_address, uint16
 
     if (!nmbs->msg.broadcast)
     {
+        set_expected_res_length(nmbs, 2 + read_quantity * 2);
         return recv_read_registers_res(nmbs, read_quantity, registers_out);
     }
 
@@ -147,6 +147,14 @@ typedef enum nmbs_transport
  *
  * Additionally, an optional crc_calc() function can be defined to override the default nanoMODBUS CRC calculation function.
  *
+ * On RTU transport, an optional read_response() method can be defined to receive a whole client response in a single
+ * call when its length is known in advance. It should block until either:
+ * - `count` bytes of data are read
+ * - an exception response is complete, i.e. 5 bytes were read and the function code (second byte) has bit 7 set
+ * - the timeout, with `timeout_ms >= 0`, expires
+ *
+ * Its return value is the number of bytes actually read, or `< 0` in case of error.
+ *
  * These methods accept a pointer to arbitrary user-data, which is the arg member of this struct.
  * After the creation of an instance it can be changed with nmbs_set_platform_arg().
  */
@@ -159,6 +167,8 @@ typedef struct nmbs_platform_conf
                      void* arg); /*!< Bytes write transport function pointer */
     uint16_t (*crc_calc)(const uint8_t* data, uint32_t length,
                          void* arg); /*!< CRC calculation function pointer. Optional */
+    int32_t (*read_response)(uint8_t* buf, uint16_t count, int32_t timeout_ms,
+                             void* arg); /*!< RTU whole response read function pointer. Optional */
     void* arg;                       /*!< User data, will be passed to functions above */
     uint32_t initialized;            /*!< Reserved, workaround for older user code not calling nmbs_platform_conf_create() */
 } nmbs_platform_conf;
@@ -242,6 +252,7 @@ typedef struct nmbs_t
     {
         uint8_t buf[260];
         uint16_t buf_idx;
+        uint16_t length;  // Bytes received in buf once complete
 
         uint8_t unit_id;
         uint8_t fc;
@@ -261,6 +272,7 @@ typedef struct nmbs_t
     uint8_t address_rtu;
     uint8_t dest_address_rtu;
     uint16_t current_tid;
+    uint16_t expected_res_length;
 } nmbs_t;
 
 /**
@@ -15,4 +15,239 @@
 // Define a write command from the user point of view, use command number 1
 #define SERIAL_MODBUSCHAR_IOCSETADDR _IOWR(SERIAL_MODBUS_IOC_MAGIC, 1, unsigned long)
 
-#endif /* SERIAL_MODBUS_IOCTL_H */
\ No newline at end of file
+// Maximum number of blocks in the scan list of a port
+#define SERIAL_MODBUS_MAX_SCAN_BLOCKS 32
+
+// A block of registers read cyclically by the driver. Reads that fall entirely within a scanned
+// block are served from the driver's register image instead of going on the bus.
+struct serial_modbus_scan_block
+{
+    uint8_t slave;       // Unit id, 1 to 247
+    uint8_t function;    // 3 (holding registers) or 4 (input registers)
+    uint16_t start;      // First register address
+    uint16_t count;      // Number of registers, 1 to 125
+    uint16_t reserved;   // Must be zero
+    uint32_t period_ms;  // Scan period, at least SERIAL_MODBUS_MIN_SCAN_PERIOD_MS
+};
+
+// Shortest scan period. Blocks due faster than the bus can read them are read back to back, taking
+// turns with the other work of the port.
+#define SERIAL_MODBUS_MIN_SCAN_PERIOD_MS 1
+
+// Add a block to the scan list of the port, returns the index of the block. Changing the scan
+// list takes a file open for writing, or CAP_SYS_ADMIN.
+#define SERIAL_MODBUSCHAR_IOCSCANADD _IOW(SERIAL_MODBUS_IOC_MAGIC, 2, struct serial_modbus_scan_block)
+
+// Remove all blocks from the scan list of the port
+#define SERIAL_MODBUSCHAR_IOCSCANCLEAR _IO(SERIAL_MODBUS_IOC_MAGIC, 3)
+
+// Register range watched by an open file. poll() reports it readable, and SIGIO is sent when
+// enabled with O_ASYNC, once a value in the range changed. Changes are seen in the register image,
+// so only for slaves that have scan blocks. Reading from the file rearms it.
+struct serial_modbus_subscription
+{
+    uint8_t slave;     // Unit id, 1 to 247
+    uint8_t function;  // 3 (holding registers) or 4 (input registers)
+    uint16_t start;    // First register address
+    uint16_t count;    // Number of registers, 0 to unsubscribe
+};
+
+// Replace the subscription of the file
+#define SERIAL_MODBUSCHAR_IOCSUBSCRIBE _IOW(SERIAL_MODBUS_IOC_MAGIC, 4, struct serial_modbus_subscription)
+
+// Maximum number of transfers in a batch
+#define SERIAL_MODBUS_MAX_BATCH 64
+
+// One transfer of a batch. Reads (functions 3 and 4) fill buf, writes (function 16) send it.
+struct serial_modbus_transfer
+{
+    uint8_t slave;     // Unit id, 1 to 247
+    uint8_t function;  // 3 (read holding registers), 4 (read input registers) or 16 (write registers)
+    uint16_t address;  // First register address
+    uint16_t count;    // Number of registers, 1 to 125 for reads and 1 to 123 for writes
+    int16_t status;    // Set by the driver: 0 or a negative errno
+    uint64_t buf;      // User pointer to count registers
+};
+
+struct serial_modbus_batch
+{
+    uint32_t n_transfers;  // 1 to SERIAL_MODBUS_MAX_BATCH
+    uint32_t reserved;     // Must be zero
+    uint64_t transfers;    // User pointer to an array of struct serial_modbus_transfer
+};
+
+// Run the transfers back to back, in order, holding the bus for the whole batch. Consecutive reads
+// of neighbouring or overlapping registers are merged into a single request when they fit.
+#define SERIAL_MODBUSCHAR_IOCBATCH _IOWR(SERIAL_MODBUS_IOC_MAGIC, 5, struct serial_modbus_batch)
+
+// Settings of the open file, taking a pointer to a uint32_t. They apply to its read(), write() and
+// batch transfers from then on, without affecting other open files.
+// Unit id of read() and write(), 0 (broadcast, writes only) to 247, defaults to 1
+#define SERIAL_MODBUSCHAR_IOCSETSLAVE _IOW(SERIAL_MODBUS_IOC_MAGIC, 6, uint32_t)
+// Longest silence allowed within a response, 1 to 60000 ms, defaults to 100 ms
+#define SERIAL_MODBUSCHAR_IOCSETBYTETIMEOUT _IOW(SERIAL_MODBUS_IOC_MAGIC, 7, uint32_t)
+// Longest wait for the start of a response once the request is out, 1 to 60000 ms. The time the
+// response takes on the line is added. Defaults to 0, a timeout learned from the response times of
+// the slave (see the rtt, rto_min_ms and rto_max_ms sysfs attributes of the port).
+#define SERIAL_MODBUSCHAR_IOCSETRESPTIMEOUT _IOW(SERIAL_MODBUS_IOC_MAGIC, 8, uint32_t)
+
+// Asynchronous mode of an open file. Once enabled, write() queues requests for the bus and returns
+// without waiting, read() returns their completions, and poll() reports EPOLLIN when completions
+// are ready and EPOLLOUT when there is room for more requests. Both honour O_NONBLOCK.
+#define SERIAL_MODBUSCHAR_IOCSETASYNC _IOW(SERIAL_MODBUS_IOC_MAGIC, 9, uint32_t)
+
+// Priority of the transactions of the open file, taking a pointer to a uint32_t. The bus always
+// goes to the most urgent class waiting, transfers and batches of several requests give it up
+// between their requests. Work that waits moves up one class for every 250 ms, so lower classes
+// are delayed but never starved. Scan blocks and probes of offline slaves are background work.
+#define SERIAL_MODBUSCHAR_IOCSETPRIORITY _IOW(SERIAL_MODBUS_IOC_MAGIC, 10, uint32_t)
+
+#define SERIAL_MODBUS_PRIORITY_URGENT     0  // Alarms and setpoints
+#define SERIAL_MODBUS_PRIORITY_NORMAL     1  // Default
+#define SERIAL_MODBUS_PRIORITY_BACKGROUND 2  // Trends and bulk polling
+#define SERIAL_MODBUS_PRIORITY_COUNT      3
+
+// Share of the bus time of the open file, taking a pointer to a uint32_t, 1 to 1000, defaults to
+// 100. Open files of the same priority class take turns on the bus, each getting bus time in
+// proportion to its share, however many requests it keeps queued.
+#define SERIAL_MODBUSCHAR_IOCSETSHARES _IOW(SERIAL_MODBUS_IOC_MAGIC, 11, uint32_t)
+
+// One read/write multiple registers transaction (function 23). The slave writes the write block
+// first, then answers with the read block, so a setpoint and its acknowledge take a single round
+// trip.
+struct serial_modbus_read_write
+{
+    uint8_t slave;             // Unit id, 1 to 247
+    uint8_t reserved[7];       // Must be zero
+    uint16_t read_address;     // First holding register to read
+    uint16_t read_count;       // 1 to 125
+    uint16_t write_address;    // First holding register to write
+    uint16_t write_count;      // 1 to 121
+    uint64_t read_registers;   // User pointer to read_count registers, filled by the driver
+    uint64_t write_registers;  // User pointer to write_count registers
+};
+
+// Run a read/write multiple registers transaction, returns 0 or a negative errno
+#define SERIAL_MODBUSCHAR_IOCREADWRITE _IOW(SERIAL_MODBUS_IOC_MAGIC, 12, struct serial_modbus_read_write)
+
+// Table that read() and write() access, taking a pointer to a uint32_t holding its read function
+// code. The file position is the address of a register or of a bit. Coils and discrete inputs are
+// packed eight to a byte, the first one in the least significant bit, so a read() of n bytes
+// returns n * 8 bits. SERIAL_MODBUSCHAR_IOCREADBITS and SERIAL_MODBUSCHAR_IOCWRITEBITS move any
+// number of bits. Discrete inputs and input registers are read-only.
+#define SERIAL_MODBUSCHAR_IOCSETSPACE _IOW(SERIAL_MODBUS_IOC_MAGIC, 13, uint32_t)
+
+#define SERIAL_MODBUS_SPACE_COILS             1
+#define SERIAL_MODBUS_SPACE_DISCRETE_INPUTS   2
+#define SERIAL_MODBUS_SPACE_HOLDING_REGISTERS 3  // Default
+#define SERIAL_MODBUS_SPACE_INPUT_REGISTERS   4
+
+// A run of coils or discrete inputs of the table of the open file, for transfers that do not fill
+// whole bytes. Bits are packed as for read() and write().
+struct serial_modbus_bits
+{
+    uint16_t address;   // First bit address
+    uint16_t reserved;  // Must be zero
+    uint32_t count;     // Number of bits, at least 1, ending within the address space
+    uint64_t bits;      // User pointer to (count + 7) / 8 bytes, bits past count are cleared by reads
+                        // and left alone on the slave by writes
+};
+
+// Read or write count bits of the unit id of the file, returns the number of bits transferred,
+// fewer than count when an error or a signal stopped it after the first request
+#define SERIAL_MODBUSCHAR_IOCREADBITS  _IOW(SERIAL_MODBUS_IOC_MAGIC, 14, struct serial_modbus_bits)
+#define SERIAL_MODBUSCHAR_IOCWRITEBITS _IOW(SERIAL_MODBUS_IOC_MAGIC, 15, struct serial_modbus_bits)
+
+// Requests written and not read back as completions, per open file
+#define SERIAL_MODBUS_MAX_IN_FLIGHT 64
+
+#define SERIAL_MODBUS_MAX_REQUEST_REGISTERS 125
+
+// Record written in asynchronous mode. Coils and discrete inputs are packed in data, bit i of the
+// request being bit i % 8 of byte i / 8.
+struct serial_modbus_request
+{
+    uint64_t tag;      // Returned as is in the completion
+    uint8_t slave;     // Unit id, 1 to 247
+    uint8_t function;  // 1 (read coils), 2 (read discrete inputs), 3 (read holding registers),
+                       // 4 (read input registers), 5 (write coil), 15 (write coils) or 16 (write registers)
+    uint16_t address;  // First register or bit address
+    uint16_t count;    // Number of registers, 1 to 125 for reads and 1 to 123 for writes, or number
+                       // of bits, 1 to 2000 for reads, 1 for function 5 and 1 to 1968 for function 15
+    uint16_t reserved;
+    uint16_t data[SERIAL_MODBUS_MAX_REQUEST_REGISTERS];  // Registers or bits to write
+    uint16_t padding[3];
+};
+
+// Record read in asynchronous mode
+struct serial_modbus_completion
+{
+    uint64_t tag;
+    int32_t status;  // 0 or a negative errno
+    uint16_t count;  // Registers or bits read or written
+    uint16_t reserved;
+    uint16_t data[SERIAL_MODBUS_MAX_REQUEST_REGISTERS];  // Registers or bits read
+    uint16_t padding[3];
+};
+
+// Timing of one transaction, as read from serial_modbus/<minor>/timing in debugfs. The file holds
+// the most recent transactions of the port, oldest first. Stamps are CLOCK_MONOTONIC nanoseconds,
+// 0 when the transaction did not get that far, or when it was not requested through a file.
+struct serial_modbus_timing
+{
+    uint64_t sequence;      // Counts every transaction of the port, gaps mean records were overwritten
+    int64_t submitted_ns;   // Request queued for the bus
+    int64_t started_ns;     // Transaction got the bus
+    int64_t tx_done_ns;     // Request handed to the serial port
+    int64_t first_rx_ns;    // First byte of the response
+    int64_t last_rx_ns;     // Last byte of the response
+    int64_t completed_ns;
+    int32_t status;         // 0, a Modbus exception (positive) or a nanomodbus error (negative)
+    uint16_t address;
+    uint16_t count;
+    uint8_t slave;
+    uint8_t function;
+    uint8_t reserved[6];
+};
+
+// Register image of one slave, as mapped read-only by mmap() at SERIAL_MODBUS_IMAGE_OFFSET(slave).
+// Only slaves with scan blocks have one, mmap() fails with ENOENT for the others. Clearing the scan
+// list frees the images, existing mappings keep their last values and have to be made again once
+// blocks are added. block_seq[i] belongs to scan block i. It is odd while the driver updates the
+// registers of that block, and incremented again once they are consistent, see
+// serial_modbus_image_read().
+#define SERIAL_MODBUS_IMAGE_HEADER_SIZE 4096
+#define SERIAL_MODBUS_IMAGE_STRIDE      0x100000UL  // 1 MiB, a multiple of any page size
+#define SERIAL_MODBUS_IMAGE_OFFSET(slave) ((unsigned long)(slave)*SERIAL_MODBUS_IMAGE_STRIDE)
+
+struct serial_modbus_image
+{
+    uint32_t block_seq[SERIAL_MODBUS_MAX_SCAN_BLOCKS];
+    uint8_t reserved[SERIAL_MODBUS_IMAGE_HEADER_SIZE - SERIAL_MODBUS_MAX_SCAN_BLOCKS * sizeof(uint32_t)];
+    uint16_t holding_registers[65536];
+    uint16_t input_registers[65536];
+};
+
+#ifndef __KERNEL__
+#include <string.h>
+
+// Copy count registers out of a mapped image, retrying while the driver is updating the block.
+// Registers must lie within the scan block, they are in host byte order.
+static inline void serial_modbus_image_read(const volatile struct serial_modbus_image* image, unsigned int block,
+                                            const volatile uint16_t* registers, uint16_t* out, unsigned int count)
+{
+    uint32_t seq;
+    do
+    {
+        do
+        {
+            seq = __atomic_load_n(&image->block_seq[block], __ATOMIC_ACQUIRE);
+        } while (seq & 1);
+
+        memcpy(out, (const void*)registers, count * sizeof(uint16_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&image->block_seq[block], __ATOMIC_RELAXED) != seq);
+}
+#endif
+
+#endif /* SERIAL_MODBUS_IOCTL_H */
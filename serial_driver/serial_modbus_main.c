@@ -1,24 +1,52 @@
+#include <linux/capability.h>
 #include <linux/cdev.h>
-#include <linux/delay.h>
+#include <linux/completion.h>
+#include <linux/debugfs.h>
 #include <linux/fs.h>  // file_operations
+#include <linux/hrtimer.h>
+#include <linux/idr.h>
 #include <linux/init.h>
 #include <linux/jiffies.h>
+#include <linux/jump_label.h>
+#include <linux/kref.h>
+#include <linux/kthread.h>
+#include <linux/list.h>
+#include <linux/mm.h>
 #include <linux/mod_devicetable.h>
 #include <linux/module.h>
 #include <linux/of_device.h>
 #include <linux/platform_device.h>
+#include <linux/poll.h>
 #include <linux/printk.h>
 #include <linux/property.h>
+#include <linux/sched.h>  // set_current_state, cond_resched
+#include <linux/seq_file.h>
 #include <linux/serdev.h>
 #include <linux/slab.h>
 #include <linux/string.h>
+#include <linux/swab.h>
 #include <linux/timekeeping.h>
 #include <linux/types.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
 
 #include "byte_fifo.h"
+#include "modbus_breaker.h"
+#include "modbus_capture.h"
+#include "modbus_crc.h"
+#include "modbus_framer.h"
+#include "modbus_rtt.h"
+#include "modbus_scan.h"
+#include "modbus_sched.h"
+#include "modbus_sniff.h"
+#include "modbus_stats.h"
+#include "modbus_timing.h"
 #include "nanomodbus.h"
 #include "serial_modbus_ioctl.h"
 
+#define CREATE_TRACE_POINTS
+#include "serial_modbus_trace.h"
+
 // Meta Information
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Emile Decosterd");
@@ -27,317 +55,2854 @@ MODULE_DESCRIPTION("Simple RTU modbus driver");
 int modbus_dev_major = 0;  // use dynamic major
 int modbus_dev_minor = 0;
 
-#define BUFFER_LENGTH 256
-#define UINT16_MAX    65535
-#define INT32_MAX     2147483647
+#define BUFFER_LENGTH                    256
+#define UINT16_MAX                       65535
+#define INT32_MAX                        2147483647
+#define SERIAL_MODBUS_MAX_PORTS          8  // one minor per serdev port: /dev/serial_modbus0..7
+#define MODBUS_ADDRESS_SPACE             65536  // Register addresses, also the size of the file
+#define MODBUS_DEFAULT_UNIT_ID           0x01
+#define MODBUS_DEFAULT_BAUD              115200
+#define MODBUS_MAX_BAUD                  4000000
+#define MODBUS_DEFAULT_RX_SLACK_US       2000  // Receive path latency added to t3.5 to end a response
+#define MODBUS_MAX_RX_SLACK_US           100000
+#define MODBUS_DEFAULT_BYTE_TIMEOUT_MS   100
+#define MODBUS_DEFAULT_READ_TIMEOUT_MS   1000  // Also the adaptive timeout of a slave never heard from
+#define MODBUS_MAX_TIMEOUT_MS            60000
+#define MODBUS_DEFAULT_RTO_MIN_MS        20
+#define MODBUS_DEFAULT_RTO_MAX_MS        1000
+#define MODBUS_DEFAULT_BREAKER_FAILURES  3  // Consecutive timeouts before a slave is considered offline
+#define MODBUS_DEFAULT_PROBE_INTERVAL_MS 5000
+#define MODBUS_PROBE_TIMEOUT_MS          200  // Keeps the bus time spent on offline slaves low
+#define MODBUS_PRIORITY_AGING_MS         250  // Waiting work moves up one priority class this often
+#define MODBUS_DEFAULT_SHARES            100
+#define MODBUS_MAX_SHARES                1000
+#define MODBUS_SHARE_QUANTUM_US          100  // Bus time per share and round
+#define MODBUS_TIMING_RECORDS            1024  // Transactions kept in the timing ring of a port
+#define MODBUS_CAPTURE_FRAMES            1024  // Frames kept in the capture ring of a port
+
+// Not nanomodbus errors: the slave is considered offline, or the line never went quiet. Nothing
+// was sent either way.
+#define MODBUS_ERROR_SLAVE_DOWN ((nmbs_error)-100)
+#define MODBUS_ERROR_LINE_BUSY  ((nmbs_error)-101)
+
+// Our driver object, one per serdev port
+struct modbus_device_t
+{
+    nmbs_t nmbs;  // nanomodbus handle, only used by the bus thread
+    unsigned char rx_buffer[BUFFER_LENGTH];
+    struct byte_fifo_t fifo;  // Synchronization fifo
+    wait_queue_head_t rx_wait;  // Woken up by the receive callback once rx_ready()
+    unsigned int rx_wanted;
+    bool rx_accept_exception;
+    uint16_t rx_crc;              // Running CRC of the frame drained from the fifo so far
+    const uint8_t* rx_crc_start;  // Frame the running CRC belongs to, NULL after a flush
+    const uint8_t* rx_crc_end;
+    struct serdev_device* serdev;  // NULL once the port is removed
+    struct task_struct* bus_thread;  // Bus master, runs every transaction of the port
+    wait_queue_head_t bus_wait;      // Wakes up the bus thread
+    bool bus_kicked;                 // Background work changed, the bus thread has to look again
+    spinlock_t queue_lock;           // Protects sched, dead and the requests of the open files
+    struct modbus_sched_t sched;     // Requests waiting for the bus
+    bool dead;                       // Port removed, no more requests are accepted
+    bool listen_only;                // Sniffer mode, nothing is sent and no request is accepted
+    uint32_t baud;
+    uint32_t char_ns;                // Time of a character on the line, derived from baud
+    uint32_t t35_ns;                 // Silence between two frames, derived from baud
+    uint32_t rx_slack_us;            // Chunks reach us late, the end of a response waits that longer
+    ktime_t tx_end;                  // Our last frame left the line, estimated. Set by write_serial().
+    struct modbus_framer_t framer;   // Bursts received in listen-only mode
+    struct hrtimer silence_timer;    // Fires once the line was silent after the last bytes
+    struct modbus_framer_burst_t sniff_burst;  // Being decoded by the bus thread
+    struct modbus_sniff_t sniff;     // Traffic of the other master, only used by the bus thread
+    struct modbus_rtt_t rtt;  // Adaptive response timeout of each slave
+    struct modbus_breaker_t breaker;  // Health of each slave, offline ones are probed by the bus thread
+    ktime_t rtt_first_byte;   // First byte of the response, valid once rtt_waiting was cleared
+    ktime_t rx_last_byte;     // Last bytes received, set by the receive callback
+    bool rtt_waiting;         // Cleared by the receive callback once the response starts
+    ktime_t xfer_submitted;   // Request the bus thread is running was queued, 0 for its own work
+    uint8_t xfer_function;    // Transaction in progress, for tracing and statistics
+    uint16_t xfer_address;
+    uint16_t xfer_count;
+    ktime_t xfer_start;
+    ktime_t xfer_sent;        // Request handed to the serial port, 0 until then
+    uint32_t xfer_tx_bytes;
+    uint32_t xfer_rx_bytes;
+    struct modbus_stats_t stats;  // Bus performance, in debugfs
+    struct modbus_timing_t timing;  // Last transactions, in debugfs
+    struct modbus_capture_t capture;  // Raw bytes on the line, in debugfs
+    struct dentry* debugfs;
+    struct modbus_scan_t scan;  // Scan list and register images, scanned by the bus thread
+    spinlock_t notify_lock;          // Protects subscribers and their changed flag
+    struct list_head subscribers;    // Open files watching a register range
+    wait_queue_head_t notify_wait;   // Woken up when a subscriber has something to read
+    struct cdev* cdev;  // Char device structure, freed by the kernel once the last open file is gone
+    int minor;
+    struct kref refcount;  // Held by the port itself and by every open file
+};
+
+// Set while any port captures, so the receive and write paths skip capturing at no cost otherwise.
+// Toggled under modbus_capture_lock.
+static DEFINE_STATIC_KEY_FALSE(modbus_capture_key);
+static DEFINE_MUTEX(modbus_capture_lock);
 
-// nanomodbus handle
-static nmbs_t nmbs;
+// Ports by minor number, protected by modbus_ports_lock so open() cannot race with remove()
+static struct modbus_device_t* modbus_ports[SERIAL_MODBUS_MAX_PORTS];
+static DEFINE_MUTEX(modbus_ports_lock);
+static DEFINE_IDA(modbus_minors);
 
-// Synchronization fifo
-static unsigned char rx_buffer[BUFFER_LENGTH];
-static struct byte_fifo_t rx_fifo = {
-    .data = rx_buffer,
-    .size = BUFFER_LENGTH,
+// Who a transaction talks to and how long it waits. Every transaction applies its own target to
+// the shared nanomodbus instance, so open files do not see each other's settings.
+struct modbus_target_t
+{
+    uint8_t slave;
+    int32_t byte_timeout_ms;
+    int32_t read_timeout_ms;  // 0 for the adaptive timeout of the slave
 };
 
-// Our driver object
-struct modbus_device_t
-{
-    struct byte_fifo_t* fifo;
-    struct serdev_device* serdev;
-    struct mutex modbus_lock;
-    struct cdev cdev;  // Char device structure
+static const struct modbus_target_t modbus_default_target = {
+    .slave = MODBUS_DEFAULT_UNIT_ID,
+    .byte_timeout_ms = MODBUS_DEFAULT_BYTE_TIMEOUT_MS,
+    .read_timeout_ms = 0,
 };
-static struct modbus_device_t modbus_dev;
 
-// Private file data
+// Private file data. The file position is the register address read and written by read() and
+// write(), it is not advanced by them so the same registers can be polled without seeking.
 struct modbus_handle_t
 {
-    uint16_t start_address;
     struct modbus_device_t* dev;
+    struct modbus_target_t target;  // Set through ioctls, defaults to modbus_default_target
+    uint8_t space;                  // Read function code of the table read() and write() access
+    struct serial_modbus_subscription subscription;
+    struct list_head subscribed;  // In dev->subscribers while subscription.count is not zero
+    bool changed;                 // A subscribed register changed since the last read
+    struct fasync_struct* fasync;
+    unsigned int priority;          // Class of the transactions of this file
+    struct modbus_flow_t flows[SERIAL_MODBUS_PRIORITY_COUNT];  // Queued requests of each class, protected by dev->queue_lock
+    bool async;                     // write() queues requests, read() returns their completions
+    unsigned int pending;           // Requests queued or on the bus, protected by dev->queue_lock
+    unsigned int outstanding;       // Requests written and not read back yet, protected by dev->queue_lock
+    struct list_head completions;   // Finished requests, protected by dev->queue_lock
 };
 
-int32_t read_serial(uint8_t* buf, uint16_t count, int32_t byte_timeout_ms, void* arg)
+// A job for the bus thread. Synchronous callers wait on done, asynchronous requests end up in the
+// completions of their file. A job split over several transactions runs one of them each time it
+// gets the bus, and goes back in line in between.
+struct modbus_request_t
+{
+    struct list_head node;  // Queued in a flow, then in the completions of the file
+    bool (*run)(struct modbus_device_t* dev, struct modbus_request_t* req);  // Returns true while transactions are left
+    struct modbus_flow_t* flow;  // Charged for the bus time of the request
+    void* context;                   // Parameters and results of run
+    struct modbus_handle_t* handle;  // File of an asynchronous request, NULL otherwise
+    bool cancelled;                  // The waiter got a signal, stop before the next transaction
+    ktime_t queued;
+    int status;                      // -ENODEV if the port went away before the job ran
+    struct completion done;
+};
+
+// Request written in asynchronous mode, freed once its completion is read
+struct modbus_async_t
+{
+    struct modbus_request_t req;
+    struct modbus_target_t target;  // Settings of the file when the request was written
+    struct serial_modbus_request record;
+    struct serial_modbus_completion result;
+};
+
+// Shortest possible RTU response: unit id, function code, exception code and CRC
+#define MODBUS_RTU_EXCEPTION_LENGTH 5
+
+// Whether the queued bytes complete what the reader is waiting for. When accepting exceptions, a
+// complete exception response ends the wait as well, since it is shorter than any regular response.
+static bool rx_ready(struct modbus_device_t* dev)
+{
+    const unsigned int n_bytes = byte_fifo_count(&dev->fifo);
+    if (n_bytes >= READ_ONCE(dev->rx_wanted))
+    {
+        return true;
+    }
+
+    if (READ_ONCE(dev->rx_accept_exception) && (n_bytes >= MODBUS_RTU_EXCEPTION_LENGTH))
+    {
+        const int16_t function_code = byte_fifo_peek(&dev->fifo, 1);
+        return (function_code > 0) && (function_code & 0x80);
+    }
+
+    return false;
+}
+
+// Silence after the last bytes that ends a response
+static s64 rx_silence_ns(struct modbus_device_t* dev)
+{
+    return (s64)READ_ONCE(dev->t35_ns) + (s64)READ_ONCE(dev->rx_slack_us) * NSEC_PER_USEC;
+}
+
+// The response started and the line went silent since, whatever is missing is not coming. The
+// silence timer wakes up the reader once that happens.
+static bool rx_frame_ended(struct modbus_device_t* dev)
+{
+    return !smp_load_acquire(&dev->rtt_waiting) &&
+           (ktime_to_ns(ktime_sub(ktime_get(), READ_ONCE(dev->rx_last_byte))) >= rx_silence_ns(dev));
+}
+
+// Sleep until rx_ready(), the end of the response or the deadline. Returns 0, -ETIME if the
+// deadline passed or the response ended short, or -ERESTARTSYS.
+static int wait_for_rx(struct modbus_device_t* dev, unsigned int wanted, bool accept_exception, ktime_t deadline, bool forever)
+{
+    int res;
+
+    WRITE_ONCE(dev->rx_accept_exception, accept_exception);
+    WRITE_ONCE(dev->rx_wanted, wanted);
+
+    if (forever)
+    {
+        res = wait_event_interruptible(dev->rx_wait, rx_ready(dev) || rx_frame_ended(dev));
+    }
+    else
+    {
+        ktime_t remaining = ktime_sub(deadline, ktime_get());
+        if (remaining <= 0)
+        {
+            return -ETIME;
+        }
+        res = wait_event_interruptible_hrtimeout(dev->rx_wait, rx_ready(dev) || rx_frame_ended(dev), remaining);
+    }
+
+    return ((0 == res) && !rx_ready(dev)) ? -ETIME : res;
+}
+
+// Fold bytes drained from the fifo into the running CRC, so the footer check does not have to
+// scan the frame again. nanomodbus drains a frame into consecutive parts of its message buffer,
+// so a read that does not continue the previous one starts a new frame.
+static void rx_crc_fold(struct modbus_device_t* dev, const uint8_t* data, size_t len)
+{
+    if ((NULL == dev->rx_crc_start) || (data != dev->rx_crc_end))
+    {
+        dev->rx_crc_start = data;
+        dev->rx_crc = MODBUS_CRC_INIT;
+    }
+    dev->rx_crc = modbus_crc_update(dev->rx_crc, data, len);
+    dev->rx_crc_end = data + len;
+}
+
+uint16_t crc_calc(const uint8_t* data, uint32_t length, void* arg)
+{
+    struct modbus_device_t* dev = arg;
+
+    // The footer check of a response covers exactly the bytes drained so far
+    uint16_t crc = 0;
+    if ((data == dev->rx_crc_start) && (data + length == dev->rx_crc_end))
+    {
+        crc = dev->rx_crc;
+    }
+    else
+    {
+        crc = modbus_crc_update(MODBUS_CRC_INIT, data, length);
+    }
+
+    // nanomodbus stores the CRC big-endian, while the low byte goes first on the wire
+    return swab16(crc);
+}
+
+int32_t read_serial(uint8_t* buf, uint16_t count, int32_t byte_timeout_ms, void* arg)
+{
+    struct modbus_device_t* dev = arg;
+
+    if (NULL == buf)
+    {
+        return -EFAULT;
+    }
+
+    // Clear fifo and return immediately when timeout is zero
+    if (0 == byte_timeout_ms)
+    {
+        dev->rx_crc_start = NULL;
+        return byte_fifo_reset(&dev->fifo);
+    }
+
+    // Compute timeout. A negative byte timeout means we wait forever.
+    ktime_t timestamp_start = ktime_get();
+    ktime_t timestamp_timeout = ktime_add_ms(timestamp_start, byte_timeout_ms);
+
+    // Get data from queue. It is filled asynchronously by the receive callback, which wakes us up
+    // as soon as the missing bytes are there, so keep reading until all expected bytes were read
+    // or a timeout occured.
+    uint16_t read_bytes = 0;
+    int wait_res = 0;
+    while (true)
+    {
+        int16_t res = byte_fifo_read(&dev->fifo, buf + read_bytes, count - read_bytes);
+        if (res < 0)
+        {
+            printk_ratelimited("nanomodbus - Error reading bytes from fifo: %d", res);
+            return -EFAULT;
+        }
+        rx_crc_fold(dev, buf + read_bytes, res);
+        read_bytes += res;
+        dev->xfer_rx_bytes += res;
+
+        // On timeout, we still picked up whatever arrived in the meantime
+        if ((read_bytes >= count) || (-ETIME == wait_res))
+        {
+            break;
+        }
+
+        wait_res = wait_for_rx(dev, count - read_bytes, false, timestamp_timeout, byte_timeout_ms < 0);
+        if (-ERESTARTSYS == wait_res)
+        {
+            return -EINTR;
+        }
+    }
+
+    // Returning less than count tells nanomodbus that a timeout occured
+    if (read_bytes < count)
+    {
+        printk_ratelimited("nanomodbus - Read serial timed out (read %d of %u bytes) after %lld us", read_bytes, count, ktime_us_delta(ktime_get(), timestamp_start));
+    }
+
+    return (int32_t)read_bytes;
+}
+
+int32_t read_serial_response(uint8_t* buf, uint16_t count, int32_t timeout_ms, void* arg)
+{
+    struct modbus_device_t* dev = arg;
+
+    if (NULL == buf)
+    {
+        return -EFAULT;
+    }
+
+    if (count > BUFFER_LENGTH)
+    {
+        return -EINVAL;
+    }
+
+    // The slave cannot answer before our request is out, and the timeout only covers the wait for
+    // the response to start, so it runs from the end of the request and the response gets the time
+    // it takes on the line on top
+    ktime_t timestamp_start = ktime_get();
+    ktime_t timestamp_timeout = ktime_add_ms(max(timestamp_start, dev->tx_end), timeout_ms);
+    timestamp_timeout = ktime_add_ns(timestamp_timeout, (u64)count * READ_ONCE(dev->char_ns));
+
+    // Sleep once until the whole response, or an exception response, is queued
+    int wait_res = wait_for_rx(dev, count, true, timestamp_timeout, timeout_ms < 0);
+    if (-ERESTARTSYS == wait_res)
+    {
+        return -EINTR;
+    }
+
+    // Only take the exception frame out of the fifo, on timeout whatever arrived so far
+    unsigned int frame_length = count;
+    if (byte_fifo_count(&dev->fifo) >= MODBUS_RTU_EXCEPTION_LENGTH)
+    {
+        const int16_t function_code = byte_fifo_peek(&dev->fifo, 1);
+        if ((function_code > 0) && (function_code & 0x80))
+        {
+            frame_length = MODBUS_RTU_EXCEPTION_LENGTH;
+        }
+    }
+
+    int16_t read_bytes = byte_fifo_read(&dev->fifo, buf, frame_length);
+    if (read_bytes < 0)
+    {
+        printk_ratelimited("nanomodbus - Error reading bytes from fifo: %d", read_bytes);
+        return -EFAULT;
+    }
+
+    dev->xfer_rx_bytes += read_bytes;
+
+    // The CRC covers everything but its own two bytes
+    if (read_bytes > 2)
+    {
+        rx_crc_fold(dev, buf, read_bytes - 2);
+    }
+
+    if (-ETIME == wait_res)
+    {
+        printk_ratelimited("nanomodbus - Read response timed out (read %d of %u bytes) after %lld us", read_bytes, count, ktime_us_delta(ktime_get(), timestamp_start));
+    }
+
+    return (int32_t)read_bytes;
+}
+
+// Sleep on an hrtimer until the line was idle for t3.5, for at most timeout_ms if not negative.
+// Returns false if it never was.
+static bool line_wait_idle(struct modbus_device_t* dev, int32_t timeout_ms)
+{
+    const ktime_t give_up = (timeout_ms < 0) ? KTIME_MAX : ktime_add_ms(ktime_get(), timeout_ms);
+
+    while (true)
+    {
+        const ktime_t idle_since = max(dev->tx_end, READ_ONCE(dev->rx_last_byte));
+        ktime_t idle_at = ktime_add_ns(idle_since, READ_ONCE(dev->t35_ns));
+        const ktime_t now = ktime_get();
+        if (now >= idle_at)
+        {
+            return true;
+        }
+        if (idle_at > give_up)
+        {
+            return false;
+        }
+
+        // Bytes arriving meanwhile push the deadline, so check again after sleeping
+        set_current_state(TASK_UNINTERRUPTIBLE);
+        schedule_hrtimeout_range(&idle_at, 0, HRTIMER_MODE_ABS);
+    }
+}
+
+int32_t write_serial(const uint8_t* buf, uint16_t count, int32_t byte_timeout_ms, void* arg)
+{
+    struct modbus_device_t* dev = arg;
+
+    struct serdev_device* serdev = dev->serdev;
+    if ((NULL == serdev) || (NULL == buf))
+    {
+        return -EFAULT;
+    }
+
+    // RTU frames are separated by t3.5 of silence, after our own last frame as well as after
+    // anything received, the tail of a late response included
+    if (!line_wait_idle(dev, byte_timeout_ms))
+    {
+        return 0;  // The line never went quiet, modbus_transaction_done() reports a busy line
+    }
+
+    // Whatever arrived before the request cannot be its response
+    dev->rx_crc_start = NULL;
+    byte_fifo_reset(&dev->fifo);
+
+    // Watch for the response before it can possibly arrive
+    smp_store_release(&dev->rtt_waiting, true);
+
+    if (static_branch_unlikely(&modbus_capture_key))
+    {
+        modbus_capture_frame(&dev->capture, MODBUS_CAPTURE_TX, buf, count);
+    }
+
+    int status = serdev_device_write_buf(serdev, buf, count);
+    dev->xfer_sent = ktime_get();
+    dev->tx_end = ktime_add_ns(dev->xfer_sent, (u64)max(status, 0) * READ_ONCE(dev->char_ns));
+    if (status > 0)
+    {
+        dev->xfer_tx_bytes += status;
+    }
+    trace_serial_modbus_frame_tx(dev->minor, buf, count, status);
+
+    return status;
+}
+
+nmbs_error init_modbus_client(struct modbus_device_t* dev)
+{
+    nmbs_t* nmbs = &dev->nmbs;
+    nmbs_platform_conf conf;
+
+    nmbs_platform_conf_create(&conf);
+    conf.transport = NMBS_TRANSPORT_RTU;
+    conf.arg = dev;
+    conf.read = read_serial;
+    conf.read_response = read_serial_response;
+    conf.crc_calc = crc_calc;
+    conf.write = write_serial;
+
+    nmbs_error status = nmbs_client_create(nmbs, &conf);
+    if (status != NMBS_ERROR_NONE)
+    {
+        return status;
+    }
+
+    nmbs_set_byte_timeout(nmbs, MODBUS_DEFAULT_BYTE_TIMEOUT_MS);
+    nmbs_set_read_timeout(nmbs, MODBUS_DEFAULT_READ_TIMEOUT_MS);
+    nmbs_set_destination_rtu_address(nmbs, MODBUS_DEFAULT_UNIT_ID);
+
+    return NMBS_ERROR_NONE;
+}
+
+// Errno of a failed transaction, the same for read(), write(), batches and asynchronous requests
+static int nmbs_error_to_errno(nmbs_error err)
+{
+    if (MODBUS_ERROR_SLAVE_DOWN == err)
+    {
+        return -EHOSTDOWN;
+    }
+
+    if (MODBUS_ERROR_LINE_BUSY == err)
+    {
+        return -EBUSY;
+    }
+
+    switch (err)
+    {
+        case NMBS_ERROR_NONE:
+            return 0;
+        case NMBS_ERROR_TIMEOUT:
+            return -ETIMEDOUT;
+        case NMBS_ERROR_INVALID_ARGUMENT:
+            return -EINVAL;
+        default:
+            // Modbus exceptions are positive, everything else is a transport or framing problem
+            return (err > 0) ? -EREMOTEIO : -EIO;
+    }
+}
+
+// Everything from here to the end of the transaction runs in the bus thread. The request is only
+// remembered for tracing, function 23 is traced with its read block.
+static void modbus_transaction_begin(struct modbus_device_t* dev, const struct modbus_target_t* target, uint8_t function, uint16_t address, uint16_t count)
+{
+    dev->xfer_function = function;
+    dev->xfer_address = address;
+    dev->xfer_count = count;
+    dev->xfer_start = ktime_get();
+    dev->xfer_sent = 0;
+    dev->xfer_tx_bytes = 0;
+    dev->xfer_rx_bytes = 0;
+    trace_serial_modbus_xfer_start(dev->minor, target->slave, function, address, count);
+
+    nmbs_set_destination_rtu_address(&dev->nmbs, target->slave);
+    nmbs_set_byte_timeout(&dev->nmbs, target->byte_timeout_ms);
+    if (0 != target->read_timeout_ms)
+    {
+        nmbs_set_read_timeout(&dev->nmbs, target->read_timeout_ms);
+    }
+    else
+    {
+        nmbs_set_read_timeout(&dev->nmbs, modbus_rtt_timeout_ms(&dev->rtt, target->slave));
+    }
+}
+
+// Learn the response time and the health of the slave from the outcome of the transaction
+static nmbs_error modbus_transaction_done(struct modbus_device_t* dev, const struct modbus_target_t* target, nmbs_error err)
+{
+    const ktime_t completed = ktime_get();
+    const bool sent = (0 != dev->xfer_sent);
+    const bool received = sent && !smp_load_acquire(&dev->rtt_waiting);
+
+    // write_serial() gave up waiting for the line to go quiet, the slave was never addressed
+    if ((NMBS_ERROR_TIMEOUT == err) && !sent)
+    {
+        err = MODBUS_ERROR_LINE_BUSY;
+    }
+
+    const struct modbus_stats_sample_t sample = {
+        .slave = target->slave,
+        .outcome = (NMBS_ERROR_NONE == err)     ? MODBUS_STATS_OK
+                   : (NMBS_ERROR_TIMEOUT == err) ? MODBUS_STATS_TIMEOUT
+                   : (NMBS_ERROR_CRC == err)     ? MODBUS_STATS_CRC_ERROR
+                   : (err > 0)                   ? MODBUS_STATS_EXCEPTION
+                                                 : MODBUS_STATS_ERROR,
+        .tx_bytes = dev->xfer_tx_bytes,
+        .rx_bytes = dev->xfer_rx_bytes,
+        .tx_us = sent ? ktime_us_delta(dev->xfer_sent, dev->xfer_start) : -1,
+        .first_byte_us = received ? max_t(s64, ktime_us_delta(dev->rtt_first_byte, dev->tx_end), 0) : -1,
+        .total_us = ktime_us_delta(completed, dev->xfer_start),
+    };
+    modbus_stats_transaction(&dev->stats, &sample);
+
+    const struct serial_modbus_timing record = {
+        .submitted_ns = ktime_to_ns(dev->xfer_submitted),
+        .started_ns = ktime_to_ns(dev->xfer_start),
+        .tx_done_ns = ktime_to_ns(dev->xfer_sent),
+        .first_rx_ns = received ? ktime_to_ns(dev->rtt_first_byte) : 0,
+        .last_rx_ns = received ? ktime_to_ns(READ_ONCE(dev->rx_last_byte)) : 0,
+        .completed_ns = ktime_to_ns(completed),
+        .status = err,
+        .address = dev->xfer_address,
+        .count = dev->xfer_count,
+        .slave = target->slave,
+        .function = dev->xfer_function,
+    };
+    modbus_timing_record(&dev->timing, &record);
+    trace_serial_modbus_xfer_done(dev->minor, target->slave, dev->xfer_function, dev->xfer_address, dev->xfer_count, err, sample.total_us);
+
+    if (0 == target->slave)
+    {
+        return err;  // Broadcasts get no response
+    }
+
+    if (MODBUS_ERROR_LINE_BUSY == err)
+    {
+        return err;  // Says nothing about the slave
+    }
+
+    switch (err)
+    {
+        case NMBS_ERROR_TIMEOUT:
+            modbus_rtt_expired(&dev->rtt, target->slave);
+            modbus_breaker_failure(&dev->breaker, target->slave, ktime_get());
+            break;
+        case NMBS_ERROR_TRANSPORT:
+        case NMBS_ERROR_INVALID_ARGUMENT:
+            break;  // Says nothing about the slave
+        default:
+            // Something answered, even if garbled
+            modbus_breaker_success(&dev->breaker, target->slave);
+            if (((NMBS_ERROR_NONE == err) || (err > 0)) && !smp_load_acquire(&dev->rtt_waiting))
+            {
+                // A response or an exception: from the end of the request to the first byte of the
+                // response, the turnaround of the slave does not depend on the length of either. The
+                // end of the request is estimated, a UART faster than that can make it negative.
+                modbus_rtt_sample(&dev->rtt, target->slave, max_t(s64, ktime_us_delta(dev->rtt_first_byte, dev->tx_end), 0));
+            }
+            break;
+    }
+
+    return err;
+}
+
+// Read holding (function 3) or input (function 4) registers of a slave
+static nmbs_error modbus_read_registers(struct modbus_device_t* dev, const struct modbus_target_t* target, uint8_t function, uint16_t start, uint16_t count, uint16_t* registers)
+{
+    if (!modbus_breaker_allow(&dev->breaker, target->slave))
+    {
+        return MODBUS_ERROR_SLAVE_DOWN;
+    }
+
+    modbus_transaction_begin(dev, target, function, start, count);
+    if (4 == function)
+    {
+        return modbus_transaction_done(dev, target, nmbs_read_input_registers(&dev->nmbs, start, count, registers));
+    }
+    return modbus_transaction_done(dev, target, nmbs_read_holding_registers(&dev->nmbs, start, count, registers));
+}
+
+// Write holding registers of a slave
+static nmbs_error modbus_write_registers(struct modbus_device_t* dev, const struct modbus_target_t* target, uint16_t start, uint16_t count, const uint16_t* registers)
+{
+    if (!modbus_breaker_allow(&dev->breaker, target->slave))
+    {
+        return MODBUS_ERROR_SLAVE_DOWN;
+    }
+
+    modbus_transaction_begin(dev, target, 16, start, count);
+    return modbus_transaction_done(dev, target, nmbs_write_multiple_registers(&dev->nmbs, start, count, registers));
+}
+
+// Read coils (function 1) or discrete inputs (function 2) of a slave, packed eight to a byte
+static nmbs_error modbus_read_bits(struct modbus_device_t* dev, const struct modbus_target_t* target, uint8_t function, uint16_t start, uint16_t count, nmbs_bitfield bits)
+{
+    if (!modbus_breaker_allow(&dev->breaker, target->slave))
+    {
+        return MODBUS_ERROR_SLAVE_DOWN;
+    }
+
+    modbus_transaction_begin(dev, target, function, start, count);
+    if (2 == function)
+    {
+        return modbus_transaction_done(dev, target, nmbs_read_discrete_inputs(&dev->nmbs, start, count, bits));
+    }
+    return modbus_transaction_done(dev, target, nmbs_read_coils(&dev->nmbs, start, count, bits));
+}
+
+// Write coils of a slave, a single one with function 5 as its request is shorter
+static nmbs_error modbus_write_bits(struct modbus_device_t* dev, const struct modbus_target_t* target, uint16_t start, uint16_t count, const nmbs_bitfield bits)
+{
+    if (!modbus_breaker_allow(&dev->breaker, target->slave))
+    {
+        return MODBUS_ERROR_SLAVE_DOWN;
+    }
+
+    modbus_transaction_begin(dev, target, (1 == count) ? 5 : 15, start, count);
+    if (1 == count)
+    {
+        return modbus_transaction_done(dev, target, nmbs_write_single_coil(&dev->nmbs, start, bits[0] & 0x01));
+    }
+    return modbus_transaction_done(dev, target, nmbs_write_multiple_coils(&dev->nmbs, start, count, bits));
+}
+
+// Write then read holding registers of a slave in a single transaction (function 23)
+static nmbs_error modbus_read_write_registers(struct modbus_device_t* dev, const struct modbus_target_t* target, uint16_t read_start, uint16_t read_count, uint16_t* read_registers, uint16_t write_start, uint16_t write_count, const uint16_t* write_registers)
+{
+    if (!modbus_breaker_allow(&dev->breaker, target->slave))
+    {
+        return MODBUS_ERROR_SLAVE_DOWN;
+    }
+
+    modbus_transaction_begin(dev, target, 23, read_start, read_count);
+    return modbus_transaction_done(dev, target, nmbs_read_write_registers(&dev->nmbs, read_start, read_count, read_registers, write_start, write_count, write_registers));
+}
+
+// Check whether an offline slave is back with one short read. Returns false if no probe is due.
+static bool modbus_probe_step(struct modbus_device_t* dev)
+{
+    uint8_t slave;
+    uint16_t value;
+
+    if (!modbus_breaker_next_probe(&dev->breaker, ktime_get(), &slave))
+    {
+        return false;
+    }
+
+    struct modbus_target_t target = modbus_default_target;
+    target.slave = slave;
+    target.read_timeout_ms = min_t(uint32_t, modbus_rtt_timeout_ms(&dev->rtt, slave), MODBUS_PROBE_TIMEOUT_MS);
+
+    // Any answer, an exception included, closes the breaker again and a timeout keeps it open
+    modbus_transaction_begin(dev, &target, 3, 0, 1);
+    const nmbs_error err = modbus_transaction_done(dev, &target, nmbs_read_holding_registers(&dev->nmbs, 0, 1, &value));
+
+    // Other failures say nothing about the slave, but the probe is over. Without going back to open,
+    // the slave would stay half-open and never be probed again.
+    if ((NMBS_ERROR_TRANSPORT == err) || (NMBS_ERROR_INVALID_ARGUMENT == err) || (MODBUS_ERROR_LINE_BUSY == err))
+    {
+        modbus_breaker_failure(&dev->breaker, slave, ktime_get());
+    }
+    return true;
+}
+
+// Flag the files watching registers that just changed, and wake them up
+static void modbus_dev_notify(struct modbus_device_t* dev, const struct modbus_scan_change_t* change)
+{
+    struct modbus_handle_t* handle;
+    bool wake = false;
+
+    if (0 == change->count)
+    {
+        return;
+    }
+
+    const unsigned int end = (unsigned int)change->start + change->count;
+    spin_lock(&dev->notify_lock);
+    list_for_each_entry(handle, &dev->subscribers, subscribed)
+    {
+        const struct serial_modbus_subscription* sub = &handle->subscription;
+        if ((sub->slave == change->slave) && (sub->function == change->function) &&
+            (sub->start < end) && (change->start < (unsigned int)sub->start + sub->count))
+        {
+            handle->changed = true;
+            kill_fasync(&handle->fasync, SIGIO, POLL_IN);
+            wake = true;
+        }
+    }
+    spin_unlock(&dev->notify_lock);
+
+    if (wake)
+    {
+        wake_up_interruptible(&dev->notify_wait);
+    }
+}
+
+// Read the most overdue scan block into the image. Returns false if no block is due.
+static bool modbus_scan_step(struct modbus_device_t* dev)
+{
+    struct serial_modbus_scan_block block;
+    struct modbus_scan_change_t change;
+    unsigned int index, generation;
+    uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+
+    if (!modbus_scan_next(&dev->scan, ktime_get(), &block, &index, &generation))
+    {
+        return false;
+    }
+
+    // A block of an offline slave would fail right away, it waits for the next probe instead
+    const ktime_t offline_until = modbus_breaker_offline_until(&dev->breaker, block.slave);
+    if (0 != offline_until)
+    {
+        modbus_scan_postpone(&dev->scan, index, generation, offline_until);
+        return true;
+    }
+
+    struct modbus_target_t target = modbus_default_target;
+    target.slave = block.slave;
+    nmbs_error err = modbus_read_registers(dev, &target, block.function, block.start, block.count, registers);
+
+    modbus_scan_complete(&dev->scan, index, generation, registers, NMBS_ERROR_NONE == err, &change);
+    modbus_dev_notify(dev, &change);
+    return true;
+}
+
+// Hand a finished request back: wake up its synchronous caller, or queue its completion. The file
+// of an asynchronous request is only touched under queue_lock, so release() can wait for us.
+static void modbus_request_finish(struct modbus_device_t* dev, struct modbus_request_t* req)
+{
+    struct modbus_handle_t* handle = req->handle;
+
+    if (NULL == handle)
+    {
+        complete(&req->done);
+        return;
+    }
+
+    spin_lock(&dev->queue_lock);
+    handle->pending--;
+    list_add_tail(&req->node, &handle->completions);
+    kill_fasync(&handle->fasync, SIGIO, POLL_IN);
+    spin_unlock(&dev->queue_lock);
+
+    // release() waits uninterruptibly for the last pending request
+    wake_up(&dev->notify_wait);
+}
+
+// Fail a request that will never reach the bus, or not again
+static void modbus_request_fail(struct modbus_device_t* dev, struct modbus_request_t* req, int status)
+{
+    req->status = status;
+    if (NULL != req->handle)
+    {
+        container_of(req, struct modbus_async_t, req)->result.status = status;
+    }
+    modbus_request_finish(dev, req);
+}
+
+// Keep the image of a slave in line with what another master read or wrote
+static void modbus_sniff_apply(struct modbus_device_t* dev, const struct modbus_sniff_pair_t* pair)
+{
+    struct modbus_scan_change_t change;
+
+    if ((0 != pair->exception) || (0 == pair->n_registers) || !modbus_scan_has_image(&dev->scan, pair->slave))
+    {
+        return;
+    }
+
+    // Writes and function 23 read holding registers
+    const uint8_t function = (4 == pair->function) ? 4 : 3;
+    modbus_scan_store(&dev->scan, pair->slave, function, pair->address, pair->n_registers, pair->registers, &change);
+    modbus_dev_notify(dev, &change);
+}
+
+// Decode the bursts received in listen-only mode
+static void modbus_sniff_step(struct modbus_device_t* dev)
+{
+    struct modbus_framer_burst_t* burst = &dev->sniff_burst;
+    struct modbus_sniff_pair_t pair;
+    bool paired;
+
+    while (modbus_framer_pop(&dev->framer, ktime_get(), burst))
+    {
+        size_t pos = 0;
+        while (pos < burst->length)
+        {
+            const size_t n_bytes = modbus_sniff_decode(&dev->sniff, &burst->data[pos], burst->length - pos, &pair, &paired);
+            if (0 == n_bytes)
+            {
+                break;  // The rest cannot be delimited
+            }
+            if (paired)
+            {
+                modbus_sniff_apply(dev, &pair);
+            }
+            pos += n_bytes;
+        }
+    }
+}
+
+static bool modbus_bus_has_work(struct modbus_device_t* dev)
+{
+    return kthread_should_stop() || READ_ONCE(dev->bus_kicked) || !modbus_sched_empty(&dev->sched);
+}
+
+// The bus master of a port. It is the only user of nanomodbus, so transactions never wait for a
+// lock, and it goes from one request to the next without sleeping while requests are waiting.
+// Every transaction goes to the most urgent work, scans and probes being background work, and
+// open files of the same class share the bus according to their shares.
+static int modbus_bus_thread(void* data)
+{
+    struct modbus_device_t* dev = data;
+    bool sniffing = false;
+
+    while (!kthread_should_stop())
+    {
+        // Back to back work never sleeps, let others have the CPU in between
+        cond_resched();
+        WRITE_ONCE(dev->bus_kicked, false);
+
+        // In listen-only mode the framer timer wakes us up once a burst is complete
+        if (READ_ONCE(dev->listen_only))
+        {
+            if (!sniffing)
+            {
+                modbus_sniff_reset(&dev->sniff);
+                sniffing = true;
+            }
+            modbus_sniff_step(dev);
+            wait_event_interruptible(dev->bus_wait, modbus_bus_has_work(dev));
+            continue;
+        }
+        sniffing = false;
+
+        const ktime_t now = ktime_get();
+        const ktime_t next_due = min(modbus_scan_next_due(&dev->scan), modbus_breaker_next_due(&dev->breaker));
+        struct modbus_flow_t* flow = NULL;
+        spin_lock(&dev->queue_lock);
+        struct list_head* node = modbus_sched_dequeue(&dev->sched, next_due, now, &flow);
+        spin_unlock(&dev->queue_lock);
+
+        if (NULL != node)
+        {
+            struct modbus_request_t* req = list_entry(node, struct modbus_request_t, node);
+            const ktime_t start = ktime_get();
+            modbus_stats_queue_wait(&dev->stats, ktime_us_delta(start, req->queued));
+            dev->xfer_submitted = req->queued;
+            const bool more = req->run(dev, req);
+            dev->xfer_submitted = 0;
+
+            // The file pays for the bus time it used, before it may go away. A job with transactions
+            // left queues up again, so more urgent work gets the bus in between.
+            int status = 0;
+            spin_lock(&dev->queue_lock);
+            modbus_sched_charge(flow, ktime_us_delta(ktime_get(), start));
+            if (more)
+            {
+                status = dev->dead ? -ENODEV : (dev->listen_only ? -EPERM : 0);
+                if (0 == status)
+                {
+                    req->queued = ktime_get();
+                    modbus_sched_requeue(&dev->sched, flow, &req->node, req->queued);
+                }
+            }
+            spin_unlock(&dev->queue_lock);
+
+            if (!more)
+            {
+                modbus_request_finish(dev, req);
+            }
+            else if (status)
+            {
+                modbus_request_fail(dev, req, status);
+            }
+            continue;
+        }
+
+        // Probes are short and bring slaves back, they go before scan blocks
+        if (next_due <= now)
+        {
+            if (!modbus_probe_step(dev))
+            {
+                modbus_scan_step(dev);
+            }
+            continue;
+        }
+
+        // Idle until a request comes in or a scan block or probe is due
+        if (KTIME_MAX == next_due)
+        {
+            wait_event_interruptible(dev->bus_wait, modbus_bus_has_work(dev));
+        }
+        else
+        {
+            const ktime_t remaining = ktime_sub(next_due, ktime_get());
+            if (remaining > 0)
+            {
+                wait_event_interruptible_hrtimeout(dev->bus_wait, modbus_bus_has_work(dev), remaining);
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Background work changed, the bus thread has to recompute when it is due
+static void modbus_bus_kick(struct modbus_device_t* dev)
+{
+    WRITE_ONCE(dev->bus_kicked, true);
+    wake_up(&dev->bus_wait);
+}
+
+// The response being read ended, or in listen-only mode the burst being received is complete
+static enum hrtimer_restart modbus_silence_timer_expired(struct hrtimer* timer)
+{
+    struct modbus_device_t* dev = container_of(timer, struct modbus_device_t, silence_timer);
+
+    if (READ_ONCE(dev->listen_only))
+    {
+        modbus_bus_kick(dev);
+    }
+    else
+    {
+        wake_up_interruptible(&dev->rx_wait);
+    }
+    return HRTIMER_NORESTART;
+}
+
+// Queue a request for the bus thread. Fails with -ENODEV once the port is gone, with -EPERM in
+// listen-only mode, and with -EAGAIN if the file of an asynchronous request has too many of them
+// outstanding.
+static int modbus_submit(struct modbus_device_t* dev, struct modbus_request_t* req)
+{
+    struct modbus_handle_t* handle = req->handle;
+
+    spin_lock(&dev->queue_lock);
+    if (dev->dead)
+    {
+        spin_unlock(&dev->queue_lock);
+        return -ENODEV;
+    }
+
+    if (dev->listen_only)
+    {
+        spin_unlock(&dev->queue_lock);
+        return -EPERM;
+    }
+
+    if (NULL != handle)
+    {
+        if (handle->outstanding >= SERIAL_MODBUS_MAX_IN_FLIGHT)
+        {
+            spin_unlock(&dev->queue_lock);
+            return -EAGAIN;
+        }
+        handle->outstanding++;
+        handle->pending++;
+    }
+    req->queued = ktime_get();
+    modbus_sched_enqueue(&dev->sched, req->flow, &req->node, req->queued);
+    spin_unlock(&dev->queue_lock);
+
+    wake_up(&dev->bus_wait);
+    return 0;
+}
+
+// Run a job in the bus thread and wait until it is done. On a signal the job is asked to stop
+// before its next transaction, but it still owns its context until it returns, so we wait anyway.
+static int modbus_run_sync(struct modbus_handle_t* handle, bool (*run)(struct modbus_device_t* dev, struct modbus_request_t* req), void* context)
+{
+    struct modbus_device_t* dev = handle->dev;
+    struct modbus_request_t req = {
+        .run = run,
+        .flow = &handle->flows[READ_ONCE(handle->priority)],
+        .context = context,
+    };
+    init_completion(&req.done);
+
+    int res = modbus_submit(dev, &req);
+    if (res)
+    {
+        return res;
+    }
+
+    if (wait_for_completion_interruptible(&req.done))
+    {
+        WRITE_ONCE(req.cancelled, true);
+        wait_for_completion(&req.done);
+    }
+
+    return req.status;
+}
+
+static void modbus_dev_free(struct kref* refcount)
+{
+    struct modbus_device_t* dev = container_of(refcount, struct modbus_device_t, refcount);
+
+    modbus_scan_cleanup(&dev->scan);
+    modbus_stats_cleanup(&dev->stats);
+    modbus_timing_cleanup(&dev->timing);
+    modbus_capture_cleanup(&dev->capture);
+    kfree(dev);
+}
+
+static bool modbus_space_is_bits(uint8_t space)
+{
+    return (SERIAL_MODBUS_SPACE_COILS == space) || (SERIAL_MODBUS_SPACE_DISCRETE_INPUTS == space);
+}
+
+// Registers or bits in a user buffer of n_bytes, and back
+static size_t modbus_space_units(uint8_t space, size_t n_bytes)
+{
+    return modbus_space_is_bits(space) ? n_bytes * 8 : n_bytes / sizeof(uint16_t);
+}
+
+static size_t modbus_space_bytes(uint8_t space, size_t n_units)
+{
+    return modbus_space_is_bits(space) ? DIV_ROUND_UP(n_units, 8) : n_units * sizeof(uint16_t);
+}
+
+// A read() or write() split into the largest requests of its table, run back to back by the bus
+// thread. Bit chunks are multiples of eight, so every request starts on a byte and only the last
+// one may end within a byte.
+struct modbus_rw_job_t
+{
+    struct modbus_target_t target;
+    uint8_t space;  // Read function code of the table
+    loff_t start;
+    size_t n_units;
+    uint16_t* buffer;  // Registers or packed bits of the caller, copied from or to user space by it
+    size_t n_done;  // Registers or bits transferred before an error or a signal
+    nmbs_error err;
+};
+
+// Whether a read() or write() has requests left, and its caller still waits for them
+static bool modbus_rw_job_more(struct modbus_rw_job_t* job, struct modbus_request_t* req)
+{
+    return (job->n_done < job->n_units) && !READ_ONCE(req->cancelled);
+}
+
+static bool modbus_read_job(struct modbus_device_t* dev, struct modbus_request_t* req)
+{
+    struct modbus_rw_job_t* job = req->context;
+    const bool bits = modbus_space_is_bits(job->space);
+    const size_t max_chunk = bits ? MODBUS_MAX_READ_BITS : MODBUS_MAX_READ_REGISTERS;
+
+    // Scanned registers are served from the image, otherwise actually read from the device. Only
+    // the latter take a turn on the bus. Chunks are decoded into a buffer of the largest request,
+    // the caller's buffer only holds what it asked for.
+    uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+    nmbs_bitfield coils;
+    while (modbus_rw_job_more(job, req))
+    {
+        const uint16_t chunk = min_t(size_t, job->n_units - job->n_done, max_chunk);
+        const uint16_t address = job->start + job->n_done;
+        bool on_bus = true;
+        if (bits)
+        {
+            job->err = modbus_read_bits(dev, &job->target, job->space, address, chunk, coils);
+        }
+        else if (0 != modbus_scan_read(&dev->scan, job->target.slave, job->space, address, chunk, registers))
+        {
+            job->err = modbus_read_registers(dev, &job->target, job->space, address, chunk, registers);
+        }
+        else
+        {
+            on_bus = false;
+        }
+
+        if (NMBS_ERROR_NONE != job->err)
+        {
+            return false;
+        }
+        if (bits)
+        {
+            // Bits past the end of the transfer are cleared, whatever the slave padded with
+            uint8_t* dest = (uint8_t*)job->buffer + job->n_done / 8;
+            memcpy(dest, coils, DIV_ROUND_UP(chunk, 8));
+            if (chunk % 8)
+            {
+                dest[chunk / 8] &= (1U << (chunk % 8)) - 1;
+            }
+        }
+        else
+        {
+            memcpy(&job->buffer[job->n_done], registers, chunk * sizeof(uint16_t));
+        }
+        job->n_done += chunk;
+
+        if (on_bus)
+        {
+            break;
+        }
+    }
+
+    return modbus_rw_job_more(job, req);
+}
+
+static bool modbus_write_job(struct modbus_device_t* dev, struct modbus_request_t* req)
+{
+    struct modbus_rw_job_t* job = req->context;
+    struct modbus_scan_change_t change;
+    const bool bits = modbus_space_is_bits(job->space);
+    const size_t max_chunk = bits ? MODBUS_MAX_WRITE_BITS : MODBUS_MAX_WRITE_REGISTERS;
+
+    if (!modbus_rw_job_more(job, req))
+    {
+        return false;
+    }
+
+    const uint16_t chunk = min_t(size_t, job->n_units - job->n_done, max_chunk);
+    const uint16_t address = job->start + job->n_done;
+    if (bits)
+    {
+        nmbs_bitfield coils;
+        memcpy(coils, (const uint8_t*)job->buffer + job->n_done / 8, DIV_ROUND_UP(chunk, 8));
+        job->err = modbus_write_bits(dev, &job->target, address, chunk, coils);
+        if (NMBS_ERROR_NONE != job->err)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        const uint16_t* registers = &job->buffer[job->n_done];
+        job->err = modbus_write_registers(dev, &job->target, address, chunk, registers);
+        if (NMBS_ERROR_NONE != job->err)
+        {
+            return false;
+        }
+
+        modbus_scan_write_through(&dev->scan, job->target.slave, address, chunk, registers, &change);
+        modbus_dev_notify(dev, &change);
+    }
+    job->n_done += chunk;
+
+    return modbus_rw_job_more(job, req);
+}
+
+// Run a request written in asynchronous mode, a single transaction
+static bool modbus_async_run(struct modbus_device_t* dev, struct modbus_request_t* req)
+{
+    struct modbus_async_t* async = container_of(req, struct modbus_async_t, req);
+    const struct serial_modbus_request* record = &async->record;
+    struct serial_modbus_completion* result = &async->result;
+    struct modbus_scan_change_t change;
+    nmbs_error err = NMBS_ERROR_NONE;
+    nmbs_bitfield bits;
+
+    switch (record->function)
+    {
+        case 1:
+        case 2:
+            err = modbus_read_bits(dev, &async->target, record->function, record->address, record->count, bits);
+            if (NMBS_ERROR_NONE == err)
+            {
+                memcpy(result->data, bits, DIV_ROUND_UP(record->count, 8));
+            }
+            break;
+        case 5:
+        case 15:
+            memcpy(bits, record->data, DIV_ROUND_UP(record->count, 8));
+            err = modbus_write_bits(dev, &async->target, record->address, record->count, bits);
+            break;
+        case 16:
+            err = modbus_write_registers(dev, &async->target, record->address, record->count, record->data);
+            if (NMBS_ERROR_NONE == err)
+            {
+                modbus_scan_write_through(&dev->scan, record->slave, record->address, record->count, record->data, &change);
+                modbus_dev_notify(dev, &change);
+            }
+            break;
+        default:
+            if (0 != modbus_scan_read(&dev->scan, record->slave, record->function, record->address, record->count, result->data))
+            {
+                err = modbus_read_registers(dev, &async->target, record->function, record->address, record->count, result->data);
+            }
+            break;
+    }
+
+    result->status = nmbs_error_to_errno(err);
+    result->count = (NMBS_ERROR_NONE == err) ? record->count : 0;
+    return false;
+}
+
+static bool modbus_async_valid(const struct serial_modbus_request* record)
+{
+    unsigned int max_count = 0;
+    switch (record->function)
+    {
+        case 1:
+        case 2:
+            max_count = MODBUS_MAX_READ_BITS;
+            break;
+        case 3:
+        case 4:
+            max_count = MODBUS_MAX_READ_REGISTERS;
+            break;
+        case 5:
+            max_count = 1;
+            break;
+        case 15:
+            max_count = MODBUS_MAX_WRITE_BITS;
+            break;
+        case 16:
+            max_count = MODBUS_MAX_WRITE_REGISTERS;
+            break;
+        default:
+            return false;
+    }
+
+    return (record->slave >= 1) && (record->slave <= MODBUS_MAX_UNIT_ID) &&
+           (record->count >= 1) && (record->count <= max_count) &&
+           ((unsigned int)record->address + record->count <= MODBUS_ADDRESS_SPACE) &&
+           (0 == record->reserved);
+}
+
+static bool modbus_async_has_room(struct modbus_handle_t* handle)
+{
+    struct modbus_device_t* dev = handle->dev;
+
+    spin_lock(&dev->queue_lock);
+    const bool room = dev->dead || (handle->outstanding < SERIAL_MODBUS_MAX_IN_FLIGHT);
+    spin_unlock(&dev->queue_lock);
+
+    return room;
+}
+
+static bool modbus_async_has_completion(struct modbus_handle_t* handle)
+{
+    struct modbus_device_t* dev = handle->dev;
+
+    spin_lock(&dev->queue_lock);
+    const bool ready = dev->dead || !list_empty(&handle->completions);
+    spin_unlock(&dev->queue_lock);
+
+    return ready;
+}
+
+// Queue whole request records. Blocks while the file has too many requests outstanding, unless
+// something was queued already or O_NONBLOCK is set.
+static ssize_t modbus_async_write(struct file* filp, const char __user* buf, size_t count)
+{
+    struct modbus_handle_t* handle = filp->private_data;
+    struct modbus_device_t* dev = handle->dev;
+    const size_t n_records = count / sizeof(struct serial_modbus_request);
+    size_t n_queued = 0;
+    int res = 0;
+
+    if ((0 == n_records) || (0 != count % sizeof(struct serial_modbus_request)))
+    {
+        return -EINVAL;
+    }
+
+    for (; n_queued < n_records; n_queued++)
+    {
+        struct modbus_async_t* async = kzalloc(sizeof(struct modbus_async_t), GFP_KERNEL);
+        if (NULL == async)
+        {
+            res = -ENOMEM;
+            break;
+        }
+
+        if (copy_from_user(&async->record, buf + n_queued * sizeof(struct serial_modbus_request), sizeof(struct serial_modbus_request)))
+        {
+            res = -EFAULT;
+        }
+        else if (!modbus_async_valid(&async->record))
+        {
+            res = -EINVAL;
+        }
+        else
+        {
+            async->req.run = modbus_async_run;
+            async->req.handle = handle;
+            async->req.flow = &handle->flows[READ_ONCE(handle->priority)];
+            async->target = handle->target;
+            async->target.slave = async->record.slave;
+            async->result.tag = async->record.tag;
+
+            res = modbus_submit(dev, &async->req);
+            while ((-EAGAIN == res) && (0 == n_queued) && !(filp->f_flags & O_NONBLOCK))
+            {
+                if (wait_event_interruptible(dev->notify_wait, modbus_async_has_room(handle)))
+                {
+                    res = -ERESTARTSYS;
+                    break;
+                }
+                res = modbus_submit(dev, &async->req);
+            }
+        }
+
+        if (res)
+        {
+            kfree(async);
+            break;
+        }
+    }
+
+    // A short write reports what was queued, the error shows up again on the next call
+    return (n_queued > 0) ? n_queued * sizeof(struct serial_modbus_request) : res;
+}
+
+// Return as many completion records as are ready and fit, waiting for the first one unless
+// O_NONBLOCK is set
+static ssize_t modbus_async_read(struct file* filp, char __user* buf, size_t count)
+{
+    struct modbus_handle_t* handle = filp->private_data;
+    struct modbus_device_t* dev = handle->dev;
+    const size_t n_max = count / sizeof(struct serial_modbus_completion);
+    size_t n_read = 0;
+    int res = 0;
+
+    if (0 == n_max)
+    {
+        return -EINVAL;
+    }
+
+    while (n_read < n_max)
+    {
+        spin_lock(&dev->queue_lock);
+        struct modbus_async_t* async = list_first_entry_or_null(&handle->completions, struct modbus_async_t, req.node);
+        if (NULL != async)
+        {
+            list_del(&async->req.node);
+        }
+        const bool dead = dev->dead;
+        spin_unlock(&dev->queue_lock);
+
+        if (NULL == async)
+        {
+            if (n_read > 0)
+            {
+                break;
+            }
+            if (dead)
+            {
+                return -ENODEV;
+            }
+            if (filp->f_flags & O_NONBLOCK)
+            {
+                return -EAGAIN;
+            }
+            if (wait_event_interruptible(dev->notify_wait, modbus_async_has_completion(handle)))
+            {
+                return -ERESTARTSYS;
+            }
+            continue;
+        }
+
+        if (copy_to_user(buf + n_read * sizeof(struct serial_modbus_completion), &async->result, sizeof(struct serial_modbus_completion)))
+        {
+            // Keep it for the next read
+            spin_lock(&dev->queue_lock);
+            list_add(&async->req.node, &handle->completions);
+            spin_unlock(&dev->queue_lock);
+            res = -EFAULT;
+            break;
+        }
+
+        kfree(async);
+        spin_lock(&dev->queue_lock);
+        handle->outstanding--;
+        spin_unlock(&dev->queue_lock);
+        n_read++;
+    }
+
+    // Writers may be waiting for room
+    if (n_read > 0)
+    {
+        wake_up_interruptible(&dev->notify_wait);
+        return n_read * sizeof(struct serial_modbus_completion);
+    }
+
+    return res;
+}
+
+// Drop the requests of a file that goes away. Queued ones never reach the bus, but the one on the
+// bus has to be waited for.
+static void modbus_async_release(struct modbus_handle_t* handle)
+{
+    struct modbus_device_t* dev = handle->dev;
+    struct modbus_request_t *req, *tmp;
+    LIST_HEAD(dropped);
+
+    // Nothing else runs on the file any more, everything it has queued is asynchronous
+    spin_lock(&dev->queue_lock);
+    for (unsigned int priority = 0; priority < SERIAL_MODBUS_PRIORITY_COUNT; priority++)
+    {
+        modbus_sched_flush_flow(&handle->flows[priority], &dropped);
+    }
+    list_for_each_entry(req, &dropped, node)
+    {
+        handle->pending--;
+    }
+    spin_unlock(&dev->queue_lock);
+
+    wait_event(dev->notify_wait, 0 == READ_ONCE(handle->pending));
+
+    // The bus thread only touches the file under the lock, so once we hold it, it is done with it
+    spin_lock(&dev->queue_lock);
+    list_splice_init(&handle->completions, &dropped);
+    spin_unlock(&dev->queue_lock);
+
+    list_for_each_entry_safe(req, tmp, &dropped, node)
+    {
+        list_del(&req->node);
+        kfree(container_of(req, struct modbus_async_t, req));
+    }
+}
+
+int modbus_dev_open(struct inode* inode, struct file* filp)
+{
+    struct modbus_device_t* dev = NULL;
+    struct modbus_handle_t* modbus_handle = NULL;
+
+    // Each minor is a different port. The port may go away while files are open, so every
+    // open file holds a reference on it.
+
+    // NOTE: struct file represents a file descriptor, whereas struct inode represents the file
+    // itself => there can be multiple struct file representing multiple open descriptors
+    // on a single file, but they all point to the same inode structure.
+    const unsigned int minor = iminor(inode);
+    if (minor >= SERIAL_MODBUS_MAX_PORTS)
+    {
+        return -ENODEV;
+    }
+
+    modbus_handle = kmalloc(sizeof(struct modbus_handle_t), GFP_KERNEL);
+    if (NULL == modbus_handle)
+    {
+        return -ENOMEM;
+    }
+
+    mutex_lock(&modbus_ports_lock);
+    dev = modbus_ports[minor];
+    if (NULL != dev)
+    {
+        kref_get(&dev->refcount);
+    }
+    mutex_unlock(&modbus_ports_lock);
+
+    if (NULL == dev)
+    {
+        kfree(modbus_handle);
+        return -ENODEV;
+    }
+
+    // Each "file" has its own position, which is the register address of read/write operations
+    modbus_handle->dev = dev;  // store a pointer to our port
+    modbus_handle->target = modbus_default_target;
+    modbus_handle->space = SERIAL_MODBUS_SPACE_HOLDING_REGISTERS;
+    modbus_handle->subscription.count = 0;
+    INIT_LIST_HEAD(&modbus_handle->subscribed);
+    modbus_handle->changed = false;
+    modbus_handle->fasync = NULL;
+    modbus_handle->priority = SERIAL_MODBUS_PRIORITY_NORMAL;
+    for (unsigned int priority = 0; priority < SERIAL_MODBUS_PRIORITY_COUNT; priority++)
+    {
+        modbus_sched_flow_init(&modbus_handle->flows[priority], priority, MODBUS_DEFAULT_SHARES * MODBUS_SHARE_QUANTUM_US);
+    }
+    modbus_handle->async = false;
+    modbus_handle->pending = 0;
+    modbus_handle->outstanding = 0;
+    INIT_LIST_HEAD(&modbus_handle->completions);
+    filp->private_data = modbus_handle;
+
+    return 0;
+}
+
+int modbus_dev_release(struct inode* inode, struct file* filp)
+{
+    struct modbus_handle_t* handle = filp->private_data;
+
+    spin_lock(&handle->dev->notify_lock);
+    list_del(&handle->subscribed);
+    spin_unlock(&handle->dev->notify_lock);
+    modbus_async_release(handle);
+    fasync_helper(-1, filp, 0, &handle->fasync);
+
+    kref_put(&handle->dev->refcount, modbus_dev_free);
+    kfree(handle);  // Release the data structure created in the open function
+
+    return 0;
+}
+
+// Read n_units registers or bits of the table into buf. Returns how many were read, fewer when an
+// error or a signal stopped the transfer after the first request.
+static ssize_t modbus_rw_read(struct modbus_handle_t* handle, void __user* buf, uint8_t space, loff_t start, size_t n_units)
+{
+    if (0 == n_units)
+    {
+        return 0;
+    }
+
+    // Every read has its own buffer, so concurrent callers only meet on the bus
+    struct modbus_rw_job_t job = {
+        .target = handle->target,
+        .space = space,
+        .start = start,
+        .n_units = n_units,
+        .buffer = kvmalloc(modbus_space_bytes(space, n_units), GFP_KERNEL),
+    };
+    if (NULL == job.buffer)
+    {
+        return -ENOMEM;
+    }
+    const int res = modbus_run_sync(handle, modbus_read_job, &job);
+
+    // Get data back to user space, whatever was read before an error or a signal
+    const bool copy_failed = copy_to_user(buf, job.buffer, modbus_space_bytes(space, job.n_done)) > 0;
+    kvfree(job.buffer);
+
+    if (res)
+    {
+        return res;
+    }
+
+    if (copy_failed)
+    {
+        printk_ratelimited("Modbus device - Could not copy read data to user space!");
+        return -EFAULT;
+    }
+
+    if (job.n_done > 0)
+    {
+        return job.n_done;
+    }
+
+    if (NMBS_ERROR_NONE != job.err)
+    {
+        printk_ratelimited("Modbus device - Could not read function %u. Error: %d", space, job.err);
+        return nmbs_error_to_errno(job.err);
+    }
+
+    return -ERESTARTSYS;
+}
+
+// Write n_units registers or bits of the table from buf. Returns how many were written, fewer when
+// an error or a signal stopped the transfer after the first request.
+static ssize_t modbus_rw_write(struct modbus_handle_t* handle, const void __user* buf, uint8_t space, loff_t start, size_t n_units)
+{
+    if (0 == n_units)
+    {
+        return 0;
+    }
+
+    // Every write has its own copy of the user data, so concurrent callers only meet on the bus
+    struct modbus_rw_job_t job = {
+        .target = handle->target,
+        .space = space,
+        .start = start,
+        .n_units = n_units,
+        .buffer = vmemdup_user(buf, modbus_space_bytes(space, n_units)),
+    };
+    if (IS_ERR(job.buffer))
+    {
+        printk_ratelimited("Modbus device - Could not copy from user space!");
+        return PTR_ERR(job.buffer);
+    }
+
+    const int res = modbus_run_sync(handle, modbus_write_job, &job);
+    kvfree(job.buffer);
+
+    if (res)
+    {
+        return res;
+    }
+
+    // Report what made it to the device before an error or a signal
+    if (job.n_done > 0)
+    {
+        return job.n_done;
+    }
+
+    if (NMBS_ERROR_NONE != job.err)
+    {
+        printk_ratelimited("Modbus device - Error writing function %u: %d", space, job.err);
+        return nmbs_error_to_errno(job.err);
+    }
+
+    return -ERESTARTSYS;
+}
+
+ssize_t modbus_dev_read(struct file* filp, char __user* buf, size_t count, loff_t* f_pos)
+{
+    struct modbus_handle_t* handle = filp->private_data;
+    struct modbus_device_t* dev = handle->dev;
+
+    if ((NULL == dev) || (NULL == buf))
+    {
+        return -EFAULT;
+    }
+
+    if (READ_ONCE(handle->async))
+    {
+        return modbus_async_read(filp, buf, count);
+    }
+
+    // Check parameters, the position is the address for read(), the offset for pread(). Nobody
+    // answers a broadcast, so unit 0 cannot be read.
+    const uint8_t space = READ_ONCE(handle->space);
+    const loff_t start_addr = *f_pos;
+    const size_t n_units = modbus_space_units(space, count);
+    if (0 == handle->target.slave)
+    {
+        return -EINVAL;
+    }
+
+    if ((start_addr < 0) || (start_addr + n_units > MODBUS_ADDRESS_SPACE))
+    {
+        printk_ratelimited("Modbus device - Invalid parameters for read (start address or count)");
+        return -EINVAL;
+    }
+
+    // Rearm change notification, changes from now on are not covered by this read
+    spin_lock(&dev->notify_lock);
+    handle->changed = false;
+    spin_unlock(&dev->notify_lock);
+
+    // Scanned registers do not need the bus thread
+    uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+    if (!modbus_space_is_bits(space) && (n_units > 0) && (n_units <= MODBUS_MAX_READ_REGISTERS) &&
+        (0 == modbus_scan_read(&dev->scan, handle->target.slave, space, start_addr, n_units, registers)))
+    {
+        return copy_to_user(buf, registers, n_units * sizeof(uint16_t)) ? -EFAULT : n_units * sizeof(uint16_t);
+    }
+
+    const ssize_t n_read = modbus_rw_read(handle, buf, space, start_addr, n_units);
+    return (n_read > 0) ? modbus_space_bytes(space, n_read) : n_read;
+}
+
+ssize_t modbus_dev_write(struct file* filp, const char __user* buf, size_t count, loff_t* f_pos)
+{
+    struct modbus_handle_t* handle = filp->private_data;
+    struct modbus_device_t* dev = handle->dev;
+
+    if ((NULL == dev) || (NULL == buf))
+    {
+        return -EFAULT;
+    }
+
+    if (READ_ONCE(handle->async))
+    {
+        return modbus_async_write(filp, buf, count);
+    }
+
+    // Discrete inputs and input registers are read-only
+    const uint8_t space = READ_ONCE(handle->space);
+    if ((SERIAL_MODBUS_SPACE_COILS != space) && (SERIAL_MODBUS_SPACE_HOLDING_REGISTERS != space))
+    {
+        return -EPERM;
+    }
+
+    // Check parameters, the position is the address for write(), the offset for pwrite()
+    const loff_t start_addr = *f_pos;
+    const size_t n_units = modbus_space_units(space, count);
+    if ((start_addr < 0) || (start_addr + n_units > MODBUS_ADDRESS_SPACE))
+    {
+        printk_ratelimited("Modbus device - Invalid parameters for write (start address or count)");
+        return -EINVAL;
+    }
+
+    const ssize_t n_written = modbus_rw_write(handle, buf, space, start_addr, n_units);
+    return (n_written > 0) ? modbus_space_bytes(space, n_written) : n_written;
+}
+
+static long modbus_dev_ioctl_scan_add(struct modbus_device_t* dev, unsigned long arg)
+{
+    struct serial_modbus_scan_block config;
+
+    if (copy_from_user(&config, (void __user*)arg, sizeof(config)))
+    {
+        return -EFAULT;
+    }
+
+    int index = modbus_scan_add(&dev->scan, &config);
+    if (index < 0)
+    {
+        return index;
+    }
+
+    // The new block is due right away
+    modbus_bus_kick(dev);
+
+    return index;
+}
+
+static long modbus_dev_ioctl_subscribe(struct modbus_handle_t* handle, unsigned long arg)
+{
+    struct modbus_device_t* dev = handle->dev;
+    struct serial_modbus_subscription sub;
+
+    if (copy_from_user(&sub, (void __user*)arg, sizeof(sub)))
+    {
+        return -EFAULT;
+    }
+
+    if (sub.count > 0)
+    {
+        if ((sub.slave < 1) || (sub.slave > MODBUS_MAX_UNIT_ID) ||
+            ((3 != sub.function) && (4 != sub.function)) ||
+            ((unsigned int)sub.start + sub.count > 65536))
+        {
+            return -EINVAL;
+        }
+    }
+
+    spin_lock(&dev->notify_lock);
+    list_del_init(&handle->subscribed);
+    handle->subscription = sub;
+    handle->changed = false;
+    if (sub.count > 0)
+    {
+        list_add_tail(&handle->subscribed, &dev->subscribers);
+    }
+    spin_unlock(&dev->notify_lock);
+
+    return 0;
+}
+
+// Kernel side of a transfer of a batch
+struct modbus_batch_entry_t
+{
+    struct serial_modbus_transfer* xfer;
+    uint16_t* data;
+};
+
+// Status of a transfer that still has to go on the bus
+#define BATCH_PENDING 1
+
+static bool batch_is_read(const struct serial_modbus_transfer* xfer)
+{
+    return (3 == xfer->function) || (4 == xfer->function);
+}
+
+static bool batch_entry_before(const struct modbus_batch_entry_t* a, const struct modbus_batch_entry_t* b)
+{
+    if (a->xfer->slave != b->xfer->slave)
+    {
+        return a->xfer->slave < b->xfer->slave;
+    }
+    if (a->xfer->function != b->xfer->function)
+    {
+        return a->xfer->function < b->xfer->function;
+    }
+    return a->xfer->address < b->xfer->address;
+}
+
+// Sort a sequence of reads so that neighbouring registers of a slave share a request. Batches are
+// small, an insertion sort does.
+static void batch_sort_reads(struct modbus_batch_entry_t** reads, unsigned int n_reads)
+{
+    for (unsigned int i = 1; i < n_reads; i++)
+    {
+        struct modbus_batch_entry_t* entry = reads[i];
+        unsigned int j = i;
+        for (; (j > 0) && batch_entry_before(entry, reads[j - 1]); j--)
+        {
+            reads[j] = reads[j - 1];
+        }
+        reads[j] = entry;
+    }
+}
+
+// Run the request of the sorted reads from first on, as many of them as it can cover. Returns the
+// first read left.
+static unsigned int batch_run_read(struct modbus_device_t* dev, const struct modbus_target_t* defaults, struct modbus_batch_entry_t** reads, unsigned int n_reads, unsigned int first)
+{
+    uint16_t registers[MODBUS_MAX_READ_REGISTERS];
+    struct modbus_target_t target = *defaults;
+    const struct serial_modbus_transfer* xfer = reads[first]->xfer;
+    const unsigned int start = xfer->address;
+    unsigned int end = start + xfer->count;
+
+    // Extend the request while the next range touches it and the result still fits
+    unsigned int last = first + 1;
+    for (; last < n_reads; last++)
+    {
+        const struct serial_modbus_transfer* next = reads[last]->xfer;
+        const unsigned int next_end = max(end, (unsigned int)next->address + next->count);
+        if ((next->slave != xfer->slave) || (next->function != xfer->function) ||
+            (next->address > end) || (next_end - start > MODBUS_MAX_READ_REGISTERS))
+        {
+            break;
+        }
+        end = next_end;
+    }
+
+    target.slave = xfer->slave;
+    nmbs_error err = modbus_read_registers(dev, &target, xfer->function, start, end - start, registers);
+    for (unsigned int i = first; i < last; i++)
+    {
+        struct modbus_batch_entry_t* entry = reads[i];
+        entry->xfer->status = nmbs_error_to_errno(err);
+        if (NMBS_ERROR_NONE == err)
+        {
+            memcpy(entry->data, &registers[entry->xfer->address - start], entry->xfer->count * sizeof(uint16_t));
+        }
+    }
+
+    return last;
+}
+
+// A batch is a single job for the bus thread, which runs one of its requests per turn
+struct modbus_batch_job_t
+{
+    struct modbus_target_t defaults;
+    struct modbus_batch_entry_t* entries;
+    struct modbus_batch_entry_t** reads;  // Sequence of reads being run, sorted
+    unsigned int n_entries;
+    unsigned int next;        // First entry not looked at yet
+    unsigned int n_reads;
+    unsigned int first_read;  // First read of the sequence not run yet
+};
+
+static bool batch_has_pending(const struct modbus_batch_job_t* job)
+{
+    for (unsigned int i = job->next; i < job->n_entries; i++)
+    {
+        if (BATCH_PENDING == job->entries[i].xfer->status)
+        {
+            return true;
+        }
+    }
+
+    return job->first_read < job->n_reads;
+}
+
+// Run the next request of the pending transfers, in order but merging consecutive reads
+static bool batch_run(struct modbus_device_t* dev, struct modbus_request_t* req)
+{
+    struct modbus_batch_job_t* job = req->context;
+    struct modbus_scan_change_t change;
+
+    // Gather the reads up to the next write, they may be reordered
+    if (job->first_read >= job->n_reads)
+    {
+        job->n_reads = 0;
+        job->first_read = 0;
+        for (; job->next < job->n_entries; job->next++)
+        {
+            struct modbus_batch_entry_t* entry = &job->entries[job->next];
+            if (BATCH_PENDING != entry->xfer->status)
+            {
+                continue;
+            }
+            if (!batch_is_read(entry->xfer))
+            {
+                break;
+            }
+            job->reads[job->n_reads++] = entry;
+        }
+        batch_sort_reads(job->reads, job->n_reads);
+    }
+
+    if (job->first_read < job->n_reads)
+    {
+        job->first_read = batch_run_read(dev, &job->defaults, job->reads, job->n_reads, job->first_read);
+    }
+    else if (job->next < job->n_entries)
+    {
+        // The write that ended the sequence of reads
+        struct modbus_batch_entry_t* entry = &job->entries[job->next++];
+        struct serial_modbus_transfer* xfer = entry->xfer;
+        struct modbus_target_t target = job->defaults;
+
+        target.slave = xfer->slave;
+        nmbs_error err = modbus_write_registers(dev, &target, xfer->address, xfer->count, entry->data);
+        xfer->status = nmbs_error_to_errno(err);
+        if (NMBS_ERROR_NONE == err)
+        {
+            modbus_scan_write_through(&dev->scan, xfer->slave, xfer->address, xfer->count, entry->data, &change);
+            modbus_dev_notify(dev, &change);
+        }
+    }
+
+    return batch_has_pending(job);
+}
+
+static long modbus_dev_ioctl_batch(struct modbus_handle_t* handle, unsigned long arg)
+{
+    struct modbus_device_t* dev = handle->dev;
+    struct serial_modbus_batch batch;
+    long status = 0;
+
+    if (copy_from_user(&batch, (void __user*)arg, sizeof(batch)))
+    {
+        return -EFAULT;
+    }
+
+    if ((batch.n_transfers < 1) || (batch.n_transfers > SERIAL_MODBUS_MAX_BATCH) || (0 != batch.reserved))
+    {
+        return -EINVAL;
+    }
+
+    struct serial_modbus_transfer __user* user_xfers = u64_to_user_ptr(batch.transfers);
+    struct serial_modbus_transfer* xfers = memdup_user(user_xfers, batch.n_transfers * sizeof(struct serial_modbus_transfer));
+    if (IS_ERR(xfers))
+    {
+        return PTR_ERR(xfers);
+    }
+
+    struct modbus_batch_entry_t* entries = kcalloc(batch.n_transfers, sizeof(struct modbus_batch_entry_t), GFP_KERNEL);
+    struct modbus_batch_entry_t** reads = kcalloc(batch.n_transfers, sizeof(struct modbus_batch_entry_t*), GFP_KERNEL);
+    uint16_t* data = kmalloc_array(batch.n_transfers * MODBUS_MAX_READ_REGISTERS, sizeof(uint16_t), GFP_KERNEL);
+    if ((NULL == entries) || (NULL == reads) || (NULL == data))
+    {
+        status = -ENOMEM;
+        goto out;
+    }
+
+    // Check every transfer and get the data to write before taking the bus
+    unsigned int n_registers = 0;
+    for (unsigned int i = 0; i < batch.n_transfers; i++)
+    {
+        struct serial_modbus_transfer* xfer = &xfers[i];
+        const unsigned int max_count = batch_is_read(xfer) ? MODBUS_MAX_READ_REGISTERS : MODBUS_MAX_WRITE_REGISTERS;
+
+        entries[i].xfer = xfer;
+        entries[i].data = &data[n_registers];
+        if ((xfer->slave < 1) || (xfer->slave > MODBUS_MAX_UNIT_ID) ||
+            (!batch_is_read(xfer) && (16 != xfer->function)) ||
+            (xfer->count < 1) || (xfer->count > max_count) ||
+            ((unsigned int)xfer->address + xfer->count > 65536))
+        {
+            xfer->status = -EINVAL;
+            continue;
+        }
+        n_registers += xfer->count;
+
+        xfer->status = BATCH_PENDING;
+        if (batch_is_read(xfer))
+        {
+            // Scanned registers do not need the bus
+            if (0 == modbus_scan_read(&dev->scan, xfer->slave, xfer->function, xfer->address, xfer->count, entries[i].data))
+            {
+                xfer->status = 0;
+            }
+        }
+        else if (copy_from_user(entries[i].data, u64_to_user_ptr(xfer->buf), xfer->count * sizeof(uint16_t)))
+        {
+            xfer->status = -EFAULT;
+        }
+    }
+
+    // The batch goes on the bus one request at a time, in turn with other work
+    struct modbus_batch_job_t job = {
+        .defaults = handle->target,
+        .entries = entries,
+        .reads = reads,
+        .n_entries = batch.n_transfers,
+    };
+    const int res = modbus_run_sync(handle, batch_run, &job);
+    for (unsigned int i = 0; (0 != res) && (i < batch.n_transfers); i++)
+    {
+        if (BATCH_PENDING == xfers[i].status)
+        {
+            xfers[i].status = res;
+        }
+    }
+
+    for (unsigned int i = 0; i < batch.n_transfers; i++)
+    {
+        struct serial_modbus_transfer* xfer = &xfers[i];
+        if ((0 == xfer->status) && batch_is_read(xfer) &&
+            copy_to_user(u64_to_user_ptr(xfer->buf), entries[i].data, xfer->count * sizeof(uint16_t)))
+        {
+            xfer->status = -EFAULT;
+        }
+    }
+
+    if (copy_to_user(user_xfers, xfers, batch.n_transfers * sizeof(struct serial_modbus_transfer)))
+    {
+        status = -EFAULT;
+    }
+
+out:
+    kfree(data);
+    kfree(reads);
+    kfree(entries);
+    kfree(xfers);
+    return status;
+}
+
+// Registers of a read/write multiple registers ioctl
+struct modbus_read_write_job_t
+{
+    struct modbus_target_t target;
+    struct serial_modbus_read_write rw;
+    uint16_t read_registers[MODBUS_MAX_READ_REGISTERS];
+    uint16_t write_registers[MODBUS_MAX_RW_WRITE_REGISTERS];
+    nmbs_error err;
+};
+
+static bool modbus_read_write_job(struct modbus_device_t* dev, struct modbus_request_t* req)
+{
+    struct modbus_read_write_job_t* job = req->context;
+    const struct serial_modbus_read_write* rw = &job->rw;
+    struct modbus_scan_change_t change;
+
+    job->err = modbus_read_write_registers(dev, &job->target, rw->read_address, rw->read_count, job->read_registers, rw->write_address, rw->write_count, job->write_registers);
+    if (NMBS_ERROR_NONE == job->err)
+    {
+        modbus_scan_write_through(&dev->scan, rw->slave, rw->write_address, rw->write_count, job->write_registers, &change);
+        modbus_dev_notify(dev, &change);
+    }
+    return false;
+}
+
+static long modbus_dev_ioctl_read_write(struct modbus_handle_t* handle, unsigned long arg)
+{
+    struct modbus_read_write_job_t job;
+    struct serial_modbus_read_write* rw = &job.rw;
+
+    if (copy_from_user(rw, (void __user*)arg, sizeof(*rw)))
+    {
+        return -EFAULT;
+    }
+
+    if ((rw->slave < 1) || (rw->slave > MODBUS_MAX_UNIT_ID) || memchr_inv(rw->reserved, 0, sizeof(rw->reserved)) ||
+        (rw->read_count < 1) || (rw->read_count > MODBUS_MAX_READ_REGISTERS) ||
+        ((unsigned int)rw->read_address + rw->read_count > MODBUS_ADDRESS_SPACE) ||
+        (rw->write_count < 1) || (rw->write_count > MODBUS_MAX_RW_WRITE_REGISTERS) ||
+        ((unsigned int)rw->write_address + rw->write_count > MODBUS_ADDRESS_SPACE))
+    {
+        return -EINVAL;
+    }
+
+    if (copy_from_user(job.write_registers, u64_to_user_ptr(rw->write_registers), rw->write_count * sizeof(uint16_t)))
+    {
+        return -EFAULT;
+    }
+
+    job.target = handle->target;
+    job.target.slave = rw->slave;
+    job.err = NMBS_ERROR_NONE;
+    const int res = modbus_run_sync(handle, modbus_read_write_job, &job);
+    if (res)
+    {
+        return res;
+    }
+
+    if (NMBS_ERROR_NONE != job.err)
+    {
+        return nmbs_error_to_errno(job.err);
+    }
+
+    return copy_to_user(u64_to_user_ptr(rw->read_registers), job.read_registers, rw->read_count * sizeof(uint16_t)) ? -EFAULT : 0;
+}
+
+// Coils or discrete inputs by the bit, where read() and write() move eight at a time
+static long modbus_dev_ioctl_bits(struct modbus_handle_t* handle, unsigned int cmd, unsigned long arg)
+{
+    struct serial_modbus_bits bits;
+
+    if (copy_from_user(&bits, (void __user*)arg, sizeof(bits)))
+    {
+        return -EFAULT;
+    }
+
+    const uint8_t space = READ_ONCE(handle->space);
+    const bool write = (SERIAL_MODBUSCHAR_IOCWRITEBITS == cmd);
+    if (!modbus_space_is_bits(space))
+    {
+        return -EINVAL;
+    }
+
+    // Discrete inputs are read-only, nobody answers a read of a broadcast
+    if (write ? (SERIAL_MODBUS_SPACE_COILS != space) : (0 == handle->target.slave))
+    {
+        return write ? -EPERM : -EINVAL;
+    }
+
+    if ((0 != bits.reserved) || (0 == bits.count) || ((unsigned long)bits.address + bits.count > MODBUS_ADDRESS_SPACE))
+    {
+        return -EINVAL;
+    }
+
+    if (write)
+    {
+        return modbus_rw_write(handle, u64_to_user_ptr(bits.bits), space, bits.address, bits.count);
+    }
+    return modbus_rw_read(handle, u64_to_user_ptr(bits.bits), space, bits.address, bits.count);
+}
+
+static long modbus_dev_ioctl_target(struct modbus_handle_t* handle, unsigned int cmd, unsigned long arg)
+{
+    uint32_t value = 0;
+
+    if (copy_from_user(&value, (void __user*)arg, sizeof(value)))
+    {
+        return -EFAULT;
+    }
+
+    // Only used by the transactions of this file, applied when they start
+    switch (cmd)
+    {
+        case SERIAL_MODBUSCHAR_IOCSETSLAVE:
+            if (value > MODBUS_MAX_UNIT_ID)
+            {
+                return -EINVAL;
+            }
+            handle->target.slave = value;
+            break;
+        case SERIAL_MODBUSCHAR_IOCSETBYTETIMEOUT:
+            // No infinite timeouts, a missing slave would hold the bus forever
+            if ((value < 1) || (value > MODBUS_MAX_TIMEOUT_MS))
+            {
+                return -EINVAL;
+            }
+            handle->target.byte_timeout_ms = value;
+            break;
+        case SERIAL_MODBUSCHAR_IOCSETRESPTIMEOUT:
+            if (value > MODBUS_MAX_TIMEOUT_MS)
+            {
+                return -EINVAL;
+            }
+            handle->target.read_timeout_ms = value;
+            break;
+        case SERIAL_MODBUSCHAR_IOCSETASYNC:
+            if (value > 1)
+            {
+                return -EINVAL;
+            }
+            WRITE_ONCE(handle->async, value);
+            break;
+        case SERIAL_MODBUSCHAR_IOCSETPRIORITY:
+            if (value > SERIAL_MODBUS_PRIORITY_BACKGROUND)
+            {
+                return -EINVAL;
+            }
+            WRITE_ONCE(handle->priority, value);
+            break;
+        case SERIAL_MODBUSCHAR_IOCSETSHARES:
+            if ((value < 1) || (value > MODBUS_MAX_SHARES))
+            {
+                return -EINVAL;
+            }
+            spin_lock(&handle->dev->queue_lock);
+            for (unsigned int priority = 0; priority < SERIAL_MODBUS_PRIORITY_COUNT; priority++)
+            {
+                handle->flows[priority].quantum_us = value * MODBUS_SHARE_QUANTUM_US;
+            }
+            spin_unlock(&handle->dev->queue_lock);
+            break;
+        case SERIAL_MODBUSCHAR_IOCSETSPACE:
+            if ((value < SERIAL_MODBUS_SPACE_COILS) || (value > SERIAL_MODBUS_SPACE_INPUT_REGISTERS))
+            {
+                return -EINVAL;
+            }
+            WRITE_ONCE(handle->space, value);
+            break;
+    }
+
+    return 0;
+}
+
+long int modbus_dev_ioctl(struct file* filp, unsigned int cmd, unsigned long arg)
+{
+    struct modbus_handle_t* handle = filp->private_data;
+    unsigned long new_address = 0;
+
+    // Check if command is supported
+    switch (cmd)
+    {
+        case SERIAL_MODBUSCHAR_IOCSETADDR:
+            break;
+        case SERIAL_MODBUSCHAR_IOCSCANADD:
+        case SERIAL_MODBUSCHAR_IOCSCANCLEAR:
+            // The scan list is shared by every file of the port
+            if (!(filp->f_mode & FMODE_WRITE) && !capable(CAP_SYS_ADMIN))
+            {
+                return -EPERM;
+            }
+            if (SERIAL_MODBUSCHAR_IOCSCANCLEAR == cmd)
+            {
+                modbus_scan_clear(&handle->dev->scan);
+                return 0;
+            }
+            return modbus_dev_ioctl_scan_add(handle->dev, arg);
+        case SERIAL_MODBUSCHAR_IOCSUBSCRIBE:
+            return modbus_dev_ioctl_subscribe(handle, arg);
+        case SERIAL_MODBUSCHAR_IOCBATCH:
+            return modbus_dev_ioctl_batch(handle, arg);
+        case SERIAL_MODBUSCHAR_IOCREADWRITE:
+            return modbus_dev_ioctl_read_write(handle, arg);
+        case SERIAL_MODBUSCHAR_IOCREADBITS:
+        case SERIAL_MODBUSCHAR_IOCWRITEBITS:
+            return modbus_dev_ioctl_bits(handle, cmd, arg);
+        case SERIAL_MODBUSCHAR_IOCSETSLAVE:
+        case SERIAL_MODBUSCHAR_IOCSETBYTETIMEOUT:
+        case SERIAL_MODBUSCHAR_IOCSETRESPTIMEOUT:
+        case SERIAL_MODBUSCHAR_IOCSETASYNC:
+        case SERIAL_MODBUSCHAR_IOCSETPRIORITY:
+        case SERIAL_MODBUSCHAR_IOCSETSHARES:
+        case SERIAL_MODBUSCHAR_IOCSETSPACE:
+            return modbus_dev_ioctl_target(handle, cmd, arg);
+        default:
+            return -ENOTTY;
+    }
+
+    // We are working in the kernel space -> need to copy memory
+    if (copy_from_user(&new_address, (void __user*)arg, sizeof(unsigned long)))
+    {
+        return -EFAULT;
+    }
+
+    // Sanity check of provided value
+    if (new_address >= MODBUS_ADDRESS_SPACE)
+    {
+        return -EINVAL;
+    }
+
+    // Actual purpose of the ioctl call, kept for users that do not seek
+    vfs_setpos(filp, new_address, MODBUS_ADDRESS_SPACE);
+
+    return 0;
+}
+
+static __poll_t modbus_dev_poll(struct file* filp, poll_table* wait)
+{
+    struct modbus_handle_t* handle = filp->private_data;
+    struct modbus_device_t* dev = handle->dev;
+    __poll_t mask = 0;
+
+    poll_wait(filp, &dev->notify_wait, wait);
+
+    spin_lock(&dev->notify_lock);
+    if (handle->changed)
+    {
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+    spin_unlock(&dev->notify_lock);
+
+    spin_lock(&dev->queue_lock);
+    if (!list_empty(&handle->completions))
+    {
+        mask |= EPOLLIN | EPOLLRDNORM;
+    }
+    if (handle->async && (handle->outstanding < SERIAL_MODBUS_MAX_IN_FLIGHT))
+    {
+        mask |= EPOLLOUT | EPOLLWRNORM;
+    }
+    spin_unlock(&dev->queue_lock);
+
+    if (NULL == READ_ONCE(dev->serdev))
+    {
+        mask |= EPOLLHUP | EPOLLERR;
+    }
+
+    return mask;
+}
+
+static int modbus_dev_fasync(int fd, struct file* filp, int on)
+{
+    struct modbus_handle_t* handle = filp->private_data;
+
+    return fasync_helper(fd, filp, on, &handle->fasync);
+}
+
+// Positions are register addresses, SEEK_END is the end of the address space
+static loff_t modbus_dev_llseek(struct file* filp, loff_t offset, int whence)
+{
+    return fixed_size_llseek(filp, offset, whence, MODBUS_ADDRESS_SPACE);
+}
+
+// Map the register image of a slave read-only, the file offset selects the slave
+static int modbus_dev_mmap(struct file* filp, struct vm_area_struct* vma)
+{
+    struct modbus_handle_t* handle = filp->private_data;
+    const unsigned long stride_pages = SERIAL_MODBUS_IMAGE_STRIDE >> PAGE_SHIFT;
+    const unsigned long slave = vma->vm_pgoff / stride_pages;
+
+    if (vma->vm_flags & VM_WRITE)
+    {
+        return -EPERM;
+    }
+
+    // Nor may it become writable later through mprotect()
+    vm_flags_clear(vma, VM_MAYWRITE);
+
+    if ((slave < 1) || (slave > MODBUS_MAX_UNIT_ID))
+    {
+        return -EINVAL;
+    }
+
+    // Only scanned slaves have an image, the mapping fails if it goes past it
+    return modbus_scan_map_image(&handle->dev->scan, slave, vma, vma->vm_pgoff % stride_pages);
+}
+
+struct file_operations modbus_dev_fops = {
+    .owner = THIS_MODULE,
+    .llseek = modbus_dev_llseek,
+    .read = modbus_dev_read,
+    .write = modbus_dev_write,
+    .unlocked_ioctl = modbus_dev_ioctl,
+    .mmap = modbus_dev_mmap,
+    .poll = modbus_dev_poll,
+    .fasync = modbus_dev_fasync,
+    .open = modbus_dev_open,
+    .release = modbus_dev_release,
+};
+
+static int modbus_dev_setup_cdev(struct modbus_device_t* dev)
+{
+    int err, devno = MKDEV(modbus_dev_major, modbus_dev_minor + dev->minor);
+
+    dev->cdev = cdev_alloc();
+    if (NULL == dev->cdev)
+    {
+        return -ENOMEM;
+    }
+    dev->cdev->owner = THIS_MODULE;
+    dev->cdev->ops = &modbus_dev_fops;
+    err = cdev_add(dev->cdev, devno, 1);
+    if (err)
+    {
+        printk(KERN_ERR "Error %d adding modbus_dev cdev", err);
+        kobject_put(&dev->cdev->kobj);
+        dev->cdev = NULL;
+    }
+    return err;
+}
+
+// Learned response times, in the sysfs directory of the serdev device
+static ssize_t rtt_show(struct device* device, struct device_attribute* attr, char* buf)
+{
+    struct modbus_device_t* dev = dev_get_drvdata(device);
+    struct modbus_rtt_t* rtt = &dev->rtt;
+    int len = sysfs_emit(buf, "unit srtt_us rttvar_us rto_ms samples\n");
+
+    spin_lock(&rtt->lock);
+    for (unsigned int slave = 1; slave <= MODBUS_MAX_UNIT_ID; slave++)
+    {
+        const struct modbus_rtt_slave_t* estimate = &rtt->slaves[slave];
+        if (0 != estimate->samples)
+        {
+            len += sysfs_emit_at(buf, len, "%u %u %u %u %u\n", slave, estimate->srtt_us, estimate->rttvar_us, estimate->rto_ms, estimate->samples);
+        }
+    }
+    spin_unlock(&rtt->lock);
+
+    return len;
+}
+static DEVICE_ATTR_RO(rtt);
+
+static ssize_t rto_bound_store(struct device* device, const char* buf, size_t count, bool is_max)
 {
-    (void)arg;  // unused
+    struct modbus_device_t* dev = dev_get_drvdata(device);
+    unsigned int value;
 
-    if (NULL == buf)
+    int res = kstrtouint(buf, 0, &value);
+    if (res)
     {
-        return -EFAULT;
+        return res;
     }
 
-    // Clear fifo and return immediately when timeout is zero
-    if (0 == byte_timeout_ms)
+    if (value > MODBUS_MAX_TIMEOUT_MS)
     {
-        return byte_fifo_reset(&rx_fifo);
+        return -EINVAL;
     }
 
-    // Compute timeout
-    uint64_t timestamp_now = ktime_get_ns();
-    uint64_t timeout_ns = ((uint64_t)byte_timeout_ms) * ((uint64_t)1000000);
-    uint64_t timestamp_timeout = timestamp_now + timeout_ns;
+    res = is_max ? modbus_rtt_set_bounds(&dev->rtt, READ_ONCE(dev->rtt.min_ms), value)
+                 : modbus_rtt_set_bounds(&dev->rtt, value, READ_ONCE(dev->rtt.max_ms));
+    return res ? res : count;
+}
 
-    // Get data from queue. It might be filled asynchronously, so keep reading until
-    // all expected bytes were read or a timeout occured.
-    uint16_t read_bytes = 0;
-    while ((read_bytes < count) && (ktime_get_ns() < timestamp_timeout))
+static ssize_t rto_min_ms_show(struct device* device, struct device_attribute* attr, char* buf)
+{
+    struct modbus_device_t* dev = dev_get_drvdata(device);
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->rtt.min_ms));
+}
+
+static ssize_t rto_min_ms_store(struct device* device, struct device_attribute* attr, const char* buf, size_t count)
+{
+    return rto_bound_store(device, buf, count, false);
+}
+static DEVICE_ATTR_RW(rto_min_ms);
+
+static ssize_t rto_max_ms_show(struct device* device, struct device_attribute* attr, char* buf)
+{
+    struct modbus_device_t* dev = dev_get_drvdata(device);
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->rtt.max_ms));
+}
+
+static ssize_t rto_max_ms_store(struct device* device, struct device_attribute* attr, const char* buf, size_t count)
+{
+    return rto_bound_store(device, buf, count, true);
+}
+static DEVICE_ATTR_RW(rto_max_ms);
+
+// Slaves that are or were offline
+static ssize_t health_show(struct device* device, struct device_attribute* attr, char* buf)
+{
+    static const char* const state_names[] = {
+        [MODBUS_BREAKER_CLOSED] = "closed",
+        [MODBUS_BREAKER_OPEN] = "open",
+        [MODBUS_BREAKER_HALF_OPEN] = "half-open",
+    };
+    struct modbus_device_t* dev = dev_get_drvdata(device);
+    struct modbus_breaker_t* breaker = &dev->breaker;
+    int len = sysfs_emit(buf, "unit state failures trips\n");
+
+    spin_lock(&breaker->lock);
+    for (unsigned int slave = 1; slave <= MODBUS_MAX_UNIT_ID; slave++)
     {
-        uint16_t bytes_left_to_read = count - read_bytes;
-        int16_t res = byte_fifo_read(&rx_fifo, buf, bytes_left_to_read);
-        if (res >= 0)
-        {
-            read_bytes += res;
-        }
-        else
+        const struct modbus_breaker_slave_t* health = &breaker->slaves[slave];
+        if ((0 != health->failures) || (0 != health->trips))
         {
-            printk("nanomodbus - Error reading bytes from fifo: %d", res);
-            return -EFAULT;
+            len += sysfs_emit_at(buf, len, "%u %s %u %u\n", slave, state_names[health->state], health->failures, health->trips);
         }
-        msleep(10);  // Needed so fifo can be written elsewhere (mutex)
-    }
-
-    // Result check
-    uint64_t timestamp_stop = ktime_get_ns();
-    if (timestamp_stop > timestamp_timeout)
-    {
-        printk("nanomodbus - Read serial timed out (read %d bytes). Timestamp start: %llu, timestamp stop: %llu", read_bytes, timestamp_now, timestamp_stop);
-        return -ETIMEDOUT;
     }
+    spin_unlock(&breaker->lock);
 
-    printk("nanomodbus - Read %d of %u bytes from fifo", read_bytes, count);
-    return (int32_t)read_bytes;
+    return len;
 }
+static DEVICE_ATTR_RO(health);
 
-int32_t write_serial(const uint8_t* buf, uint16_t count, int32_t byte_timeout_ms, void* arg)
+static ssize_t breaker_store(struct device* device, const char* buf, size_t count, bool is_interval)
 {
-    (void)arg;  // unused
+    struct modbus_device_t* dev = dev_get_drvdata(device);
+    unsigned int value;
 
-    struct serdev_device* serdev = modbus_dev.serdev;
-    if ((NULL == serdev) || (NULL == buf))
+    int res = kstrtouint(buf, 0, &value);
+    if (res)
     {
-        return -EFAULT;
+        return res;
     }
 
-    int status = serdev_device_write_buf(serdev, buf, count);
-    printk("nanomodbus - Wrote %d bytes.\n", status);
+    res = is_interval ? modbus_breaker_configure(&dev->breaker, READ_ONCE(dev->breaker.threshold), value)
+                      : modbus_breaker_configure(&dev->breaker, value, READ_ONCE(dev->breaker.probe_interval_ms));
+    return res ? res : count;
+}
 
-    return status;
+static ssize_t breaker_failures_show(struct device* device, struct device_attribute* attr, char* buf)
+{
+    struct modbus_device_t* dev = dev_get_drvdata(device);
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->breaker.threshold));
 }
 
-nmbs_error init_modbus_client(nmbs_t* nmbs)
+static ssize_t breaker_failures_store(struct device* device, struct device_attribute* attr, const char* buf, size_t count)
 {
-    nmbs_platform_conf conf;
+    return breaker_store(device, buf, count, false);
+}
+static DEVICE_ATTR_RW(breaker_failures);
 
-    nmbs_platform_conf_create(&conf);
-    conf.transport = NMBS_TRANSPORT_RTU;
-    conf.read = read_serial;
-    conf.write = write_serial;
+static ssize_t probe_interval_ms_show(struct device* device, struct device_attribute* attr, char* buf)
+{
+    struct modbus_device_t* dev = dev_get_drvdata(device);
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->breaker.probe_interval_ms));
+}
 
-    nmbs_error status = nmbs_client_create(nmbs, &conf);
-    if (status != NMBS_ERROR_NONE)
+static ssize_t probe_interval_ms_store(struct device* device, struct device_attribute* attr, const char* buf, size_t count)
+{
+    return breaker_store(device, buf, count, true);
+}
+static DEVICE_ATTR_RW(probe_interval_ms);
+
+// The UART may only get close to the requested speed, the timings follow what it actually runs at
+static void modbus_set_baud(struct modbus_device_t* dev, uint32_t baud)
+{
+    const unsigned int actual = serdev_device_set_baudrate(dev->serdev, baud);
+    if (actual > 0)
     {
-        return status;
+        baud = actual;
     }
 
-    nmbs_set_byte_timeout(nmbs, 100);
-    nmbs_set_read_timeout(nmbs, 1000);
-
-    return NMBS_ERROR_NONE;
+    WRITE_ONCE(dev->baud, baud);
+    WRITE_ONCE(dev->char_ns, modbus_framer_char_ns(baud));
+    WRITE_ONCE(dev->t35_ns, modbus_framer_t35_ns(baud));
+    modbus_framer_set_baud(&dev->framer, baud);
 }
 
-int modbus_dev_open(struct inode* inode, struct file* filp)
+// Line speed, RTU timings follow it
+static ssize_t baud_show(struct device* device, struct device_attribute* attr, char* buf)
 {
-    struct modbus_device_t* dev = NULL;
-    struct modbus_handle_t* modbus_handle = NULL;
-
-    printk("Open modbus char device");
-
-    // Our device is global and persistent -> no need to do any particular device handling.
-    // Only store a pointer to our device in the file structure for ease of access
+    struct modbus_device_t* dev = dev_get_drvdata(device);
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->baud));
+}
 
-    // NOTE: struct file represents a file descriptor, whereas struct inode represents the file
-    // itself => there can be multiple struct file representing multiple open descriptors
-    // on a single file, but they all point to the same inode structure.
-    dev = container_of(inode->i_cdev, struct modbus_device_t, cdev);
+static ssize_t baud_store(struct device* device, struct device_attribute* attr, const char* buf, size_t count)
+{
+    struct modbus_device_t* dev = dev_get_drvdata(device);
+    unsigned int value;
 
-    modbus_handle = kmalloc(sizeof(struct modbus_handle_t), GFP_KERNEL);
-    if (NULL == modbus_handle)
+    int res = kstrtouint(buf, 0, &value);
+    if (res)
     {
-        return -ENOMEM;
+        return res;
     }
 
-    // Each "file" will have a different start address for read/write operations
-    modbus_handle->start_address = 0;
-    modbus_handle->dev = dev;  // store a pointer to our global device
-    filp->private_data = modbus_handle;
+    if ((value < 1) || (value > MODBUS_MAX_BAUD))
+    {
+        return -EINVAL;
+    }
 
-    return 0;
+    modbus_set_baud(dev, value);
+    return count;
 }
+static DEVICE_ATTR_RW(baud);
 
-int modbus_dev_release(struct inode* inode, struct file* filp)
+static ssize_t rx_slack_us_show(struct device* device, struct device_attribute* attr, char* buf)
 {
-    printk("Modbus Device Release");
-
-    kfree(filp->private_data);  // Release the data structure created in the open function
-
-    return 0;
+    struct modbus_device_t* dev = dev_get_drvdata(device);
+    return sysfs_emit(buf, "%u\n", READ_ONCE(dev->rx_slack_us));
 }
 
-ssize_t modbus_dev_read(struct file* filp, char __user* buf, size_t count, loff_t* f_pos)
+static ssize_t rx_slack_us_store(struct device* device, struct device_attribute* attr, const char* buf, size_t count)
 {
-    struct modbus_handle_t* handle = filp->private_data;
-    struct modbus_device_t* dev = handle->dev;
+    struct modbus_device_t* dev = dev_get_drvdata(device);
+    unsigned int value;
 
-    if ((NULL == dev) || (NULL == buf))
+    int res = kstrtouint(buf, 0, &value);
+    if (res)
     {
-        return -EFAULT;
+        return res;
     }
 
-    // Check parameters
-    const uint16_t start_addr = handle->start_address;
-    const size_t n_regs = count / 2;           // Modbus registers are 16-bit, count is the number of bytes
-    if ((start_addr + n_regs > UINT16_MAX) ||  // Modbus address space limit
-        (n_regs > 125))                        // max 250 bytes of data per transaction
+    if (value > MODBUS_MAX_RX_SLACK_US)
     {
-        printk("Modbus device - Invalid parameters for read (start address or count)");
         return -EINVAL;
     }
 
-    const size_t buffer_size = n_regs * sizeof(uint16_t);
-    uint16_t* kbuffer = kmalloc(buffer_size, GFP_KERNEL);
-    if (NULL == kbuffer)
+    WRITE_ONCE(dev->rx_slack_us, value);
+    return count;
+}
+static DEVICE_ATTR_RW(rx_slack_us);
+
+// Listen-only mode: the port only decodes the traffic of another master, updating the images of
+// the slaves it sees. Requests queued when it is switched on fail with -EPERM.
+static ssize_t listen_only_show(struct device* device, struct device_attribute* attr, char* buf)
+{
+    struct modbus_device_t* dev = dev_get_drvdata(device);
+    return sysfs_emit(buf, "%d\n", READ_ONCE(dev->listen_only));
+}
+
+static ssize_t listen_only_store(struct device* device, struct device_attribute* attr, const char* buf, size_t count)
+{
+    struct modbus_device_t* dev = dev_get_drvdata(device);
+    struct modbus_request_t *req, *tmp;
+    LIST_HEAD(leftovers);
+    bool enable;
+
+    int res = kstrtobool(buf, &enable);
+    if (res)
     {
-        return -ENOMEM;
+        return res;
     }
 
-    // Actually read from the device
-    mutex_lock(&dev->modbus_lock);
-    nmbs_error err = nmbs_read_holding_registers(&nmbs, start_addr, n_regs, kbuffer);
-    mutex_unlock(&dev->modbus_lock);
-    if (NMBS_ERROR_NONE != err)
+    // The framer starts over on the next bytes, which go to the fifo or to the framer from now on
+    modbus_framer_reset(&dev->framer);
+    spin_lock(&dev->queue_lock);
+    WRITE_ONCE(dev->listen_only, enable);
+    if (enable)
     {
-        printk("Modbus device - Could not read holding registers. Error: %d", err);
-        kfree(kbuffer);
-        return -EIO;
+        modbus_sched_flush(&dev->sched, &leftovers);
     }
+    spin_unlock(&dev->queue_lock);
 
-    // Get data back to user space
-    if (copy_to_user(buf, kbuffer, buffer_size) > 0)
+    list_for_each_entry_safe(req, tmp, &leftovers, node)
     {
-        printk("Modbus device - Could not copy read data to user space!");
-        kfree(kbuffer);
-        return -EFAULT;
+        list_del_init(&req->node);
+        modbus_request_fail(dev, req, -EPERM);
     }
+    modbus_bus_kick(dev);
 
-    kfree(kbuffer);
-    return count;  // Here we read everything at once
+    return count;
 }
+static DEVICE_ATTR_RW(listen_only);
 
-ssize_t modbus_dev_write(struct file* filp, const char __user* buf, size_t count, loff_t* f_pos)
+// What listen-only mode decoded so far
+static ssize_t sniffer_show(struct device* device, struct device_attribute* attr, char* buf)
 {
-    struct modbus_handle_t* handle = filp->private_data;
-    struct modbus_device_t* dev = handle->dev;
+    struct modbus_device_t* dev = dev_get_drvdata(device);
+    const struct modbus_sniff_t* sniff = &dev->sniff;
 
-    if ((NULL == dev) || (NULL == buf))
-    {
-        return -EFAULT;
-    }
+    return sysfs_emit(buf, "frames %u pairs %u crc_errors %u unanswered %u garbage_bytes %u dropped_bursts %u broken_bursts %u\n",
+                      READ_ONCE(sniff->frames), READ_ONCE(sniff->pairs), READ_ONCE(sniff->crc_errors),
+                      READ_ONCE(sniff->unanswered), READ_ONCE(sniff->garbage_bytes), READ_ONCE(dev->framer.dropped),
+                      READ_ONCE(dev->framer.broken_bursts));
+}
+static DEVICE_ATTR_RO(sniffer);
+
+// Bus statistics of each port in debugfs, serial_modbus/<minor>/stats. Writing anything to the
+// file resets them.
+static struct dentry* modbus_debugfs_root;
 
-    // Check parameters
-    const uint16_t start_addr = handle->start_address;
-    const size_t n_regs = count / 2;           // Modbus registers are 16-bit, count is the number of bytes
-    if ((start_addr + n_regs > UINT16_MAX) ||  // Modbus address space limit
-        (n_regs > 125))                        // max 250 bytes of data per transaction
+static void modbus_stats_show_counters(struct seq_file* m, const char* prefix, const struct modbus_stats_counters_t* counters)
+{
+    static const char* const latency_names[] = {
+        [MODBUS_STATS_QUEUE_WAIT] = "queue_wait_us",
+        [MODBUS_STATS_TX] = "tx_us",
+        [MODBUS_STATS_FIRST_BYTE] = "first_byte_us",
+        [MODBUS_STATS_TOTAL] = "total_us",
+    };
+
+    seq_printf(m, "%s transactions %llu tx_bytes %llu rx_bytes %llu timeouts %llu crc_errors %llu exceptions %llu errors %llu fifo_overruns %llu queue_wait_us %llu\n",
+               prefix, counters->transactions, counters->tx_bytes, counters->rx_bytes, counters->timeouts, counters->crc_errors,
+               counters->exceptions, counters->errors, counters->fifo_overruns, counters->queue_wait_us);
+    for (unsigned int latency = 0; latency < MODBUS_STATS_LATENCIES; latency++)
     {
-        printk("Modbus device - Invalid parameters for write (start address or count)");
-        return -EINVAL;
+        seq_printf(m, "%s %s", prefix, latency_names[latency]);
+        for (unsigned int bucket = 0; bucket < MODBUS_STATS_BUCKETS; bucket++)
+        {
+            seq_printf(m, " %llu", counters->histograms[latency][bucket]);
+        }
+        seq_putc(m, '\n');
     }
+}
+
+static int modbus_stats_show(struct seq_file* m, void* v)
+{
+    struct modbus_device_t* dev = m->private;
+    struct modbus_stats_t* stats = &dev->stats;
+    char prefix[16];
 
-    const size_t buffer_size = n_regs * sizeof(uint16_t);
-    uint16_t* kbuffer = kmalloc(buffer_size, GFP_KERNEL);
-    if (NULL == kbuffer)
+    // Exclusive upper bound of each histogram bucket
+    seq_puts(m, "buckets_us");
+    for (unsigned int bucket = 0; bucket < MODBUS_STATS_BUCKETS - 1; bucket++)
     {
-        return -ENOMEM;
+        seq_printf(m, " %llu", 1ULL << bucket);
     }
+    seq_puts(m, " inf\n");
 
-    // We will manipulate memory in the kernel space
-    if (copy_from_user(kbuffer, buf, buffer_size))
+    spin_lock(&stats->lock);
+    seq_printf(m, "since_ms %lld\n", ktime_ms_delta(ktime_get(), stats->since));
+    modbus_stats_show_counters(m, "port", &stats->port);
+    for (unsigned int slave = 0; slave <= MODBUS_MAX_UNIT_ID; slave++)
     {
-        printk("Modbus device - Could not copy from user space!");
-        kfree(kbuffer);
-        return -EFAULT;
+        if (0 != stats->slaves[slave].transactions)
+        {
+            snprintf(prefix, sizeof(prefix), "unit %u", slave);
+            modbus_stats_show_counters(m, prefix, &stats->slaves[slave]);
+        }
     }
+    spin_unlock(&stats->lock);
+
+    return 0;
+}
+
+static int modbus_stats_open(struct inode* inode, struct file* file)
+{
+    return single_open(file, modbus_stats_show, inode->i_private);
+}
+
+static ssize_t modbus_stats_write(struct file* file, const char __user* buf, size_t count, loff_t* f_pos)
+{
+    struct seq_file* m = file->private_data;
+    struct modbus_device_t* dev = m->private;
+
+    modbus_stats_reset(&dev->stats);
+    return count;
+}
 
-    mutex_lock(&dev->modbus_lock);
-    nmbs_error err = nmbs_write_multiple_registers(&nmbs, start_addr, n_regs, kbuffer);
-    mutex_unlock(&dev->modbus_lock);
+static const struct file_operations modbus_stats_fops = {
+    .owner = THIS_MODULE,
+    .open = modbus_stats_open,
+    .read = seq_read,
+    .write = modbus_stats_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
 
-    kfree(kbuffer);
+// Timing ring of each port in debugfs, serial_modbus/<minor>/timing, as an array of struct
+// serial_modbus_timing. Every open() takes a new snapshot.
+struct modbus_timing_dump_t
+{
+    size_t length;
+    struct serial_modbus_timing records[MODBUS_TIMING_RECORDS];
+};
 
-    if (NMBS_ERROR_NONE != err)
+static int modbus_timing_open(struct inode* inode, struct file* file)
+{
+    struct modbus_device_t* dev = inode->i_private;
+    struct modbus_timing_dump_t* dump = vmalloc(sizeof(struct modbus_timing_dump_t));
+    if (NULL == dump)
     {
-        printk("Modbus device - Error writing registers: %d", err);
-        return -ENODEV;
+        return -ENOMEM;
     }
 
-    return count;  // Here we wrote everything we wanted
+    dump->length = modbus_timing_snapshot(&dev->timing, dump->records) * sizeof(struct serial_modbus_timing);
+    file->private_data = dump;
+    return 0;
 }
 
-long int modbus_dev_ioctl(struct file* filp, unsigned int cmd, unsigned long arg)
+static ssize_t modbus_timing_read(struct file* file, char __user* buf, size_t count, loff_t* f_pos)
 {
-    struct modbus_handle_t* handle = filp->private_data;
-    unsigned long new_address = 0;
+    struct modbus_timing_dump_t* dump = file->private_data;
 
-    // Check if command is supported
-    if (SERIAL_MODBUSCHAR_IOCSETADDR != cmd)
+    return simple_read_from_buffer(buf, count, f_pos, dump->records, dump->length);
+}
+
+// Frees the copy a debugfs file took on open
+static int modbus_snapshot_release(struct inode* inode, struct file* file)
+{
+    vfree(file->private_data);
+    return 0;
+}
+
+static const struct file_operations modbus_timing_fops = {
+    .owner = THIS_MODULE,
+    .open = modbus_timing_open,
+    .read = modbus_timing_read,
+    .llseek = default_llseek,
+    .release = modbus_snapshot_release,
+};
+
+// Frames of each port in debugfs: writing 1 to serial_modbus/<minor>/capture_enable starts a new
+// capture, writing 0 stops it. serial_modbus/<minor>/capture reads as a pcap file, every packet
+// starting with a direction byte, 0 for sent and 1 for received.
+static int modbus_capture_set(struct modbus_device_t* dev, bool enable)
+{
+    int res = 0;
+
+    mutex_lock(&modbus_capture_lock);
+    if (enable)
     {
-        return -ENOTTY;
+        const bool was_enabled = dev->capture.enabled;
+        res = modbus_capture_start(&dev->capture, MODBUS_CAPTURE_FRAMES);
+        if ((0 == res) && !was_enabled)
+        {
+            static_branch_inc(&modbus_capture_key);
+        }
     }
-
-    // We are working in the kernel space -> need to copy memory
-    if (copy_from_user(&new_address, (void __user*)arg, sizeof(unsigned long)))
+    else if (dev->capture.enabled)
     {
-        return -EFAULT;
+        modbus_capture_stop(&dev->capture);
+        static_branch_dec(&modbus_capture_key);
     }
+    mutex_unlock(&modbus_capture_lock);
 
-    // Sanity check of provided value
-    if (new_address >= UINT16_MAX)
+    return res;
+}
+
+static ssize_t modbus_capture_enable_read(struct file* file, char __user* buf, size_t count, loff_t* f_pos)
+{
+    struct modbus_device_t* dev = file->private_data;
+    const char* value = READ_ONCE(dev->capture.enabled) ? "1\n" : "0\n";
+
+    return simple_read_from_buffer(buf, count, f_pos, value, 2);
+}
+
+static ssize_t modbus_capture_enable_write(struct file* file, const char __user* buf, size_t count, loff_t* f_pos)
+{
+    struct modbus_device_t* dev = file->private_data;
+    bool enable;
+
+    int res = kstrtobool_from_user(buf, count, &enable);
+    if (res)
     {
-        return -EINVAL;
+        return res;
     }
 
-    // Actual purpose of the ioctl call
-    handle->start_address = new_address;
-    printk("Modbus device - Set address %lu", new_address);
-
-    return 0;
+    res = modbus_capture_set(dev, enable);
+    return res ? res : count;
 }
 
-struct file_operations modbus_dev_fops = {
+static const struct file_operations modbus_capture_enable_fops = {
     .owner = THIS_MODULE,
-    .read = modbus_dev_read,
-    .write = modbus_dev_write,
-    .unlocked_ioctl = modbus_dev_ioctl,
-    .open = modbus_dev_open,
-    .release = modbus_dev_release,
+    .open = simple_open,
+    .read = modbus_capture_enable_read,
+    .write = modbus_capture_enable_write,
+    .llseek = default_llseek,
 };
 
-static int modbus_dev_setup_cdev(struct modbus_device_t* dev)
+struct modbus_capture_dump_t
 {
-    int err, devno = MKDEV(modbus_dev_major, modbus_dev_minor);
+    size_t length;
+    uint8_t pcap[];
+};
 
-    cdev_init(&dev->cdev, &modbus_dev_fops);
-    dev->cdev.owner = THIS_MODULE;
-    dev->cdev.ops = &modbus_dev_fops;
-    err = cdev_add(&dev->cdev, devno, 1);
-    if (err)
+static int modbus_capture_open(struct inode* inode, struct file* file)
+{
+    struct modbus_device_t* dev = inode->i_private;
+    const size_t pcap_size = modbus_capture_pcap_size(MODBUS_CAPTURE_FRAMES);
+    struct modbus_capture_dump_t* dump = vmalloc(sizeof(struct modbus_capture_dump_t) + pcap_size);
+    if (NULL == dump)
     {
-        printk(KERN_ERR "Error %d adding modbus_dev cdev", err);
+        return -ENOMEM;
     }
-    return err;
+
+    dump->length = modbus_capture_pcap(&dev->capture, dump->pcap, pcap_size);
+    file->private_data = dump;
+    return 0;
+}
+
+static ssize_t modbus_capture_read(struct file* file, char __user* buf, size_t count, loff_t* f_pos)
+{
+    struct modbus_capture_dump_t* dump = file->private_data;
+
+    return simple_read_from_buffer(buf, count, f_pos, dump->pcap, dump->length);
 }
 
+static const struct file_operations modbus_capture_fops = {
+    .owner = THIS_MODULE,
+    .open = modbus_capture_open,
+    .read = modbus_capture_read,
+    .llseek = default_llseek,
+    .release = modbus_snapshot_release,
+};
+
+static struct attribute* serdev_serial_attrs[] = {
+    &dev_attr_rtt.attr,
+    &dev_attr_rto_min_ms.attr,
+    &dev_attr_rto_max_ms.attr,
+    &dev_attr_health.attr,
+    &dev_attr_breaker_failures.attr,
+    &dev_attr_probe_interval_ms.attr,
+    &dev_attr_baud.attr,
+    &dev_attr_rx_slack_us.attr,
+    &dev_attr_listen_only.attr,
+    &dev_attr_sniffer.attr,
+    NULL,
+};
+ATTRIBUTE_GROUPS(serdev_serial);
+
 /* Declate the probe and remove functions */
 static int serdev_serial_probe(struct serdev_device* serdev);
 static void serdev_serial_remove(struct serdev_device* serdev);
@@ -355,26 +2920,58 @@ static struct serdev_device_driver serdev_serial_driver = {
     .driver = {
         .name = "serdev-serial",
         .of_match_table = serdev_serial_ids,
+        .dev_groups = serdev_serial_groups,
     },
 };
 
 // Callback is called whenever a character is received
 static int serdev_serial_recv(struct serdev_device* serdev, const unsigned char* buffer, size_t size)
 {
-    printk("serdev_serial - Received %u bytes \n", size);
+    struct modbus_device_t* dev = serdev_device_get_drvdata(serdev);
 
-    int res = byte_fifo_write(&rx_fifo, buffer, size);
-    if (res > 0)
+    // Stamp the response before publishing it, the reader finds the stamp once it sees the bytes
+    if (static_branch_unlikely(&modbus_capture_key))
     {
-        printk("serdev_serial - Overwrote %d bytes in fifo", res);
+        modbus_capture_frame(&dev->capture, MODBUS_CAPTURE_RX, buffer, size);
     }
-    else if (res < 0)
+
+    const ktime_t now = ktime_get();
+    WRITE_ONCE(dev->rx_last_byte, now);
+
+    // Nobody reads the fifo in listen-only mode, bytes go to the framer instead
+    if (READ_ONCE(dev->listen_only))
     {
-        printk("serdev_serial - Error: %d", res);
+        modbus_framer_feed(&dev->framer, buffer, size, now);
+        hrtimer_start(&dev->silence_timer, ns_to_ktime(READ_ONCE(dev->t35_ns)), HRTIMER_MODE_REL);
+        return size;
     }
-    else
+    hrtimer_start(&dev->silence_timer, ns_to_ktime(rx_silence_ns(dev)), HRTIMER_MODE_REL);
+    if (READ_ONCE(dev->rtt_waiting))
+    {
+        dev->rtt_first_byte = now;
+        smp_store_release(&dev->rtt_waiting, false);
+    }
+
+    int res = byte_fifo_write(&dev->fifo, buffer, size);
+
+    // Only wake up the reader once it can complete its request. The barrier orders the fifo
+    // update against reading rx_wanted, pairing with the one implied by the reader going to sleep.
+    smp_mb();
+    if (rx_ready(dev))
+    {
+        wake_up_interruptible(&dev->rx_wait);
+    }
+
+    trace_serial_modbus_rx_chunk(dev->minor, size, byte_fifo_count(&dev->fifo));
+    if (res > 0)
+    {
+        trace_serial_modbus_fifo_overrun(dev->minor, res);
+        modbus_stats_fifo_overrun(&dev->stats, res);
+        printk_ratelimited("serdev_serial - Fifo full, dropped %d bytes", res);
+    }
+    else if (res < 0)
     {
-        printk("serdev_serial - Write %u bytes to fifo", size);
+        printk_ratelimited("serdev_serial - Error: %d", res);
     }
 
     return size;
@@ -385,40 +2982,175 @@ static const struct serdev_device_ops serdev_serial_ops = {
 };
 
 /**
- * @brief This function is called on loading the driver
+ * @brief This function is called for every serial port matching our device tree entry
  */
 static int serdev_serial_probe(struct serdev_device* serdev)
 {
     int status;
     printk("serdev_serial - Now I am in the probe function!\n");
 
+    // Every port gets its own device, with its own bus thread, fifo and nanomodbus handle
+    struct modbus_device_t* dev = kzalloc(sizeof(struct modbus_device_t), GFP_KERNEL);
+    if (NULL == dev)
+    {
+        return -ENOMEM;
+    }
+
+    kref_init(&dev->refcount);
+    init_waitqueue_head(&dev->rx_wait);
+    init_waitqueue_head(&dev->bus_wait);
+    spin_lock_init(&dev->queue_lock);
+    modbus_sched_init(&dev->sched, MODBUS_PRIORITY_AGING_MS);
+    modbus_capture_init(&dev->capture);
+    dev->baud = MODBUS_DEFAULT_BAUD;
+    dev->char_ns = modbus_framer_char_ns(dev->baud);
+    dev->t35_ns = modbus_framer_t35_ns(dev->baud);
+    dev->rx_slack_us = MODBUS_DEFAULT_RX_SLACK_US;
+    modbus_framer_init(&dev->framer, dev->baud);
+    hrtimer_init(&dev->silence_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    dev->silence_timer.function = modbus_silence_timer_expired;
+    modbus_sniff_init(&dev->sniff);
+    modbus_scan_init(&dev->scan);
+    modbus_rtt_init(&dev->rtt, MODBUS_DEFAULT_READ_TIMEOUT_MS, MODBUS_DEFAULT_RTO_MIN_MS, MODBUS_DEFAULT_RTO_MAX_MS);
+    modbus_breaker_init(&dev->breaker, MODBUS_DEFAULT_BREAKER_FAILURES, MODBUS_DEFAULT_PROBE_INTERVAL_MS);
+    spin_lock_init(&dev->notify_lock);
+    INIT_LIST_HEAD(&dev->subscribers);
+    init_waitqueue_head(&dev->notify_wait);
+    dev->rx_wanted = 1;
+    dev->fifo.data = dev->rx_buffer;
+    dev->fifo.size = BUFFER_LENGTH;
+    byte_fifo_init(&dev->fifo);
+
+    status = modbus_stats_init(&dev->stats);
+    if (status)
+    {
+        goto err_free;
+    }
+
+    status = modbus_timing_init(&dev->timing, MODBUS_TIMING_RECORDS);
+    if (status)
+    {
+        goto err_free;
+    }
+
+    if (NMBS_ERROR_NONE != init_modbus_client(dev))
+    {
+        printk("Serial Modbus - Error initializing nanomodbus");
+        status = -ENODEV;
+        goto err_free;
+    }
+
+    dev->minor = ida_alloc_max(&modbus_minors, SERIAL_MODBUS_MAX_PORTS - 1, GFP_KERNEL);
+    if (dev->minor < 0)
+    {
+        printk("serdev_serial - No minor left, at most %d ports are supported\n", SERIAL_MODBUS_MAX_PORTS);
+        status = dev->minor;
+        goto err_free;
+    }
+
+    // Store a pointer to our device so the receive callback can find its fifo
+    dev->serdev = serdev;
+    serdev_device_set_drvdata(serdev, dev);
     serdev_device_set_client_ops(serdev, &serdev_serial_ops);
     status = serdev_device_open(serdev);
     if (status)
     {
         printk("serdev_serial - Error opening serial port!\n");
-        return -status;
+        goto err_minor;
     }
 
-    serdev_device_set_baudrate(serdev, 115200);
+    modbus_set_baud(dev, dev->baud);
     serdev_device_set_flow_control(serdev, false);
     serdev_device_set_parity(serdev, SERDEV_PARITY_NONE);
 
     // Here we could read the device identification
 
-    // Store a pointer to the serial device so we can write to it later
-    modbus_dev.serdev = serdev;
+    dev->bus_thread = kthread_run(modbus_bus_thread, dev, "modbus%d", dev->minor);
+    if (IS_ERR(dev->bus_thread))
+    {
+        printk("Serial Modbus - Error starting the bus thread");
+        status = PTR_ERR(dev->bus_thread);
+        goto err_close;
+    }
+
+    status = modbus_dev_setup_cdev(dev);
+    if (status)
+    {
+        printk("Serial Modbus - Error setting up device");
+        goto err_thread;
+    }
+
+    // Optional, nothing to check
+    char name[8];
+    snprintf(name, sizeof(name), "%d", dev->minor);
+    dev->debugfs = debugfs_create_dir(name, modbus_debugfs_root);
+    debugfs_create_file("stats", 0600, dev->debugfs, dev, &modbus_stats_fops);
+    debugfs_create_file("timing", 0400, dev->debugfs, dev, &modbus_timing_fops);
+    debugfs_create_file("capture", 0400, dev->debugfs, dev, &modbus_capture_fops);
+    debugfs_create_file("capture_enable", 0600, dev->debugfs, dev, &modbus_capture_enable_fops);
+
+    mutex_lock(&modbus_ports_lock);
+    modbus_ports[dev->minor] = dev;
+    mutex_unlock(&modbus_ports_lock);
 
+    printk("serdev_serial - Port available as minor %d\n", dev->minor);
     return 0;
+
+err_thread:
+    kthread_stop(dev->bus_thread);
+err_close:
+    serdev_device_close(serdev);
+    hrtimer_cancel(&dev->silence_timer);
+err_minor:
+    ida_free(&modbus_minors, dev->minor);
+err_free:
+    kref_put(&dev->refcount, modbus_dev_free);
+    return status;
 }
 
 /**
- * @brief This function is called on unloading the driver
+ * @brief This function is called when a port goes away, or on unloading the driver
  */
 static void serdev_serial_remove(struct serdev_device* serdev)
 {
+    struct modbus_device_t* dev = serdev_device_get_drvdata(serdev);
+
     printk("serdev_serial - Now I am in the remove function\n");
+
+    // No new open from now on
+    mutex_lock(&modbus_ports_lock);
+    modbus_ports[dev->minor] = NULL;
+    mutex_unlock(&modbus_ports_lock);
+    cdev_del(dev->cdev);
+    debugfs_remove_recursive(dev->debugfs);  // Waits for readers of the statistics
+    modbus_capture_set(dev, false);
+
+    // Refuse new requests, then let the bus thread finish its transaction. Files still open will
+    // fail from now on.
+    spin_lock(&dev->queue_lock);
+    dev->dead = true;
+    spin_unlock(&dev->queue_lock);
+    kthread_stop(dev->bus_thread);
+
+    // Requests still queued never get the bus
+    struct modbus_request_t *req, *tmp;
+    LIST_HEAD(leftovers);
+    spin_lock(&dev->queue_lock);
+    modbus_sched_flush(&dev->sched, &leftovers);
+    spin_unlock(&dev->queue_lock);
+    list_for_each_entry_safe(req, tmp, &leftovers, node)
+    {
+        list_del_init(&req->node);
+        modbus_request_fail(dev, req, -ENODEV);
+    }
+
+    WRITE_ONCE(dev->serdev, NULL);
+    wake_up_all(&dev->notify_wait);  // Pollers get EPOLLHUP, blocked readers and writers -ENODEV
+
     serdev_device_close(serdev);
+    hrtimer_cancel(&dev->silence_timer);  // No more bytes can restart it
+    ida_free(&modbus_minors, dev->minor);
+    kref_put(&dev->refcount, modbus_dev_free);
 }
 
 /**
@@ -430,13 +3162,14 @@ static int __init my_init(void)
     int result = 0;
 
     printk("Serial Modbus - Loading the serial device driver...\n");
-    if (serdev_device_driver_register(&serdev_serial_driver))
+    result = modbus_crc_init();
+    if (result)
     {
-        printk("serdev_serial - Error! Could not load serial device driver\n");
-        return -1;
+        return result;
     }
 
-    result = alloc_chrdev_region(&dev, modbus_dev_minor, 1, "serial_modbus");
+    // Ports get their char device as soon as they are probed, so reserve all minors first
+    result = alloc_chrdev_region(&dev, modbus_dev_minor, SERIAL_MODBUS_MAX_PORTS, "serial_modbus");
     modbus_dev_major = MAJOR(dev);
     if (result < 0)
     {
@@ -444,24 +3177,13 @@ static int __init my_init(void)
         return result;
     }
 
-    memset(&modbus_dev, 0, sizeof(struct modbus_device_t));
-    byte_fifo_init(&rx_fifo);
-    modbus_dev.fifo = &rx_fifo;
-    mutex_init(&modbus_dev.modbus_lock);
-
-    nmbs_error status = init_modbus_client(&nmbs);
-    if (NMBS_ERROR_NONE != status)
-    {
-        printk("Serial Modbus - Error initializing nanomodbus");
-        return -ENODEV;
-    }
-    nmbs_set_destination_rtu_address(&nmbs, 0x01);
-
-    result = modbus_dev_setup_cdev(&modbus_dev);
+    modbus_debugfs_root = debugfs_create_dir("serial_modbus", NULL);
+    result = serdev_device_driver_register(&serdev_serial_driver);
     if (result)
     {
-        printk("Serial Modbus - Error setting up device");
-        unregister_chrdev_region(dev, 1);
+        printk("serdev_serial - Error! Could not load serial device driver\n");
+        debugfs_remove_recursive(modbus_debugfs_root);
+        unregister_chrdev_region(dev, SERIAL_MODBUS_MAX_PORTS);
     }
 
     return result;
@@ -473,17 +3195,14 @@ static int __init my_init(void)
 static void __exit my_exit(void)
 {
     printk("Serial Modbus - Unload driver");
+
+    // Removes every port
     serdev_device_driver_unregister(&serdev_serial_driver);
+    debugfs_remove_recursive(modbus_debugfs_root);
 
     dev_t devno = MKDEV(modbus_dev_major, modbus_dev_minor);
-
-    cdev_del(&modbus_dev.cdev);
-
-    /**
-     * TODO: cleanup modbus_dev specific portions here as necessary
-     */
-
-    unregister_chrdev_region(devno, 1);
+    unregister_chrdev_region(devno, SERIAL_MODBUS_MAX_PORTS);
+    ida_destroy(&modbus_minors);
 }
 
 module_init(my_init);
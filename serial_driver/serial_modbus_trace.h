@@ -0,0 +1,119 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM serial_modbus
+
+#if !defined(SERIAL_MODBUS_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define SERIAL_MODBUS_TRACE_H_
+
+#include <linux/tracepoint.h>
+#include <linux/types.h>
+
+// Frame handed to the serial port, status is the number of bytes accepted or an error
+TRACE_EVENT(serial_modbus_frame_tx,
+    TP_PROTO(int minor, const uint8_t* buf, uint16_t length, int status),
+    TP_ARGS(minor, buf, length, status),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(uint8_t, slave)
+        __field(uint8_t, function)
+        __field(uint16_t, length)
+        __field(int, status)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->slave = (length > 0) ? buf[0] : 0;
+        __entry->function = (length > 1) ? buf[1] : 0;
+        __entry->length = length;
+        __entry->status = status;
+    ),
+    TP_printk("minor=%d slave=%u function=%u length=%u status=%d",
+              __entry->minor, __entry->slave, __entry->function, __entry->length, __entry->status)
+);
+
+// Bytes delivered by the receive callback, queued is what the fifo holds afterwards
+TRACE_EVENT(serial_modbus_rx_chunk,
+    TP_PROTO(int minor, size_t size, unsigned int queued),
+    TP_ARGS(minor, size, queued),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(size_t, size)
+        __field(unsigned int, queued)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->size = size;
+        __entry->queued = queued;
+    ),
+    TP_printk("minor=%d size=%zu queued=%u", __entry->minor, __entry->size, __entry->queued)
+);
+
+// Received bytes the fifo had no room for
+TRACE_EVENT(serial_modbus_fifo_overrun,
+    TP_PROTO(int minor, int dropped),
+    TP_ARGS(minor, dropped),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(int, dropped)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->dropped = dropped;
+    ),
+    TP_printk("minor=%d dropped=%d", __entry->minor, __entry->dropped)
+);
+
+TRACE_EVENT(serial_modbus_xfer_start,
+    TP_PROTO(int minor, uint8_t slave, uint8_t function, uint16_t address, uint16_t count),
+    TP_ARGS(minor, slave, function, address, count),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(uint8_t, slave)
+        __field(uint8_t, function)
+        __field(uint16_t, address)
+        __field(uint16_t, count)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->slave = slave;
+        __entry->function = function;
+        __entry->address = address;
+        __entry->count = count;
+    ),
+    TP_printk("minor=%d slave=%u function=%u address=%u count=%u",
+              __entry->minor, __entry->slave, __entry->function, __entry->address, __entry->count)
+);
+
+// Status is a nmbs_error: 0 on success, positive for a Modbus exception
+TRACE_EVENT(serial_modbus_xfer_done,
+    TP_PROTO(int minor, uint8_t slave, uint8_t function, uint16_t address, uint16_t count, int status, s64 duration_us),
+    TP_ARGS(minor, slave, function, address, count, status, duration_us),
+    TP_STRUCT__entry(
+        __field(int, minor)
+        __field(uint8_t, slave)
+        __field(uint8_t, function)
+        __field(uint16_t, address)
+        __field(uint16_t, count)
+        __field(int, status)
+        __field(s64, duration_us)
+    ),
+    TP_fast_assign(
+        __entry->minor = minor;
+        __entry->slave = slave;
+        __entry->function = function;
+        __entry->address = address;
+        __entry->count = count;
+        __entry->status = status;
+        __entry->duration_us = duration_us;
+    ),
+    TP_printk("minor=%d slave=%u function=%u address=%u count=%u status=%d duration_us=%lld",
+              __entry->minor, __entry->slave, __entry->function, __entry->address, __entry->count,
+              __entry->status, __entry->duration_us)
+);
+
+#endif  // SERIAL_MODBUS_TRACE_H_
+
+// The trace header is not in include/trace/events, define_trace.h looks it up next to the module
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE serial_modbus_trace
+#include <trace/define_trace.h>
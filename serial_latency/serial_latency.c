@@ -0,0 +1,260 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "../serial_driver/serial_modbus_ioctl.h"
+
+#define DEFAULT_TIMING_FILE "/sys/kernel/debug/serial_modbus/0/timing"
+#define MAX_RECORDS         65536
+
+// Intervals between the stamps of a record, in the order they happen
+enum phase_t
+{
+    PHASE_QUEUE,       // submitted -> started
+    PHASE_TX,          // started -> tx_done
+    PHASE_FIRST_BYTE,  // tx_done -> first_rx
+    PHASE_RX,          // first_rx -> last_rx
+    PHASE_DECODE,      // last_rx -> completed
+    PHASE_BUS,         // started -> completed
+    PHASE_TOTAL,       // submitted -> completed
+    PHASE_COUNT,
+};
+
+static const char* const phase_names[PHASE_COUNT] = {
+    [PHASE_QUEUE] = "queue",
+    [PHASE_TX] = "tx",
+    [PHASE_FIRST_BYTE] = "first_byte",
+    [PHASE_RX] = "rx",
+    [PHASE_DECODE] = "decode",
+    [PHASE_BUS] = "bus",
+    [PHASE_TOTAL] = "total",
+};
+
+static struct serial_modbus_timing records[MAX_RECORDS];
+static int64_t samples[MAX_RECORDS];
+
+static void usage(const char* name)
+{
+    printf("Usage: %s [-t] [-u unit] [timing file]\n", name);
+    printf("  Prints latency percentiles of the transactions in the timing ring of a port,\n");
+    printf("  by default %s\n", DEFAULT_TIMING_FILE);
+    printf("  -t       also print a timeline, one transaction per line\n");
+    printf("  -u unit  only look at the transactions of one unit id\n");
+}
+
+static size_t read_records(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        printf("ERR - Could not open %s: %s\n", path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    size_t n_bytes = 0;
+    while (n_bytes < sizeof(records))
+    {
+        ssize_t res = read(fd, (char*)records + n_bytes, sizeof(records) - n_bytes);
+        if (res < 0)
+        {
+            printf("ERR - Could not read %s: %s\n", path, strerror(errno));
+            close(fd);
+            exit(EXIT_FAILURE);
+        }
+        if (0 == res)
+        {
+            break;
+        }
+        n_bytes += res;
+    }
+    close(fd);
+
+    return n_bytes / sizeof(struct serial_modbus_timing);
+}
+
+// Duration of a phase in nanoseconds, or -1 if the transaction did not have it
+static int64_t phase_ns(const struct serial_modbus_timing* record, enum phase_t phase)
+{
+    int64_t from = 0;
+    int64_t to = 0;
+
+    switch (phase)
+    {
+        case PHASE_QUEUE:
+            from = record->submitted_ns;
+            to = record->started_ns;
+            break;
+        case PHASE_TX:
+            from = record->started_ns;
+            to = record->tx_done_ns;
+            break;
+        case PHASE_FIRST_BYTE:
+            from = record->tx_done_ns;
+            to = record->first_rx_ns;
+            break;
+        case PHASE_RX:
+            from = record->first_rx_ns;
+            to = record->last_rx_ns;
+            break;
+        case PHASE_DECODE:
+            from = record->last_rx_ns;
+            to = record->completed_ns;
+            break;
+        case PHASE_BUS:
+            from = record->started_ns;
+            to = record->completed_ns;
+            break;
+        default:
+            from = record->submitted_ns;
+            to = record->completed_ns;
+            break;
+    }
+
+    return ((0 == from) || (0 == to) || (to < from)) ? -1 : to - from;
+}
+
+static int compare_samples(const void* a, const void* b)
+{
+    const int64_t x = *(const int64_t*)a;
+    const int64_t y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest rank percentile of sorted samples, in microseconds
+static double percentile_us(const int64_t* sorted, size_t n_samples, double percent)
+{
+    size_t rank = (size_t)(percent / 100.0 * n_samples + 0.5);
+    rank = (rank < 1) ? 1 : ((rank > n_samples) ? n_samples : rank);
+    return sorted[rank - 1] / 1000.0;
+}
+
+static bool selected(const struct serial_modbus_timing* record, int unit)
+{
+    return (unit < 0) || (record->slave == unit);
+}
+
+static void print_percentiles(size_t n_records, int unit)
+{
+    printf("%-10s %8s %10s %10s %10s %10s %10s %10s\n", "phase_us", "count", "min", "p50", "p90", "p99", "p99.9", "max");
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        size_t n_samples = 0;
+        for (size_t i = 0; i < n_records; i++)
+        {
+            const int64_t ns = phase_ns(&records[i], phase);
+            if (selected(&records[i], unit) && (ns >= 0))
+            {
+                samples[n_samples++] = ns;
+            }
+        }
+
+        if (0 == n_samples)
+        {
+            printf("%-10s %8zu\n", phase_names[phase], n_samples);
+            continue;
+        }
+
+        qsort(samples, n_samples, sizeof(int64_t), compare_samples);
+        printf("%-10s %8zu %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f\n", phase_names[phase], n_samples,
+               samples[0] / 1000.0, percentile_us(samples, n_samples, 50), percentile_us(samples, n_samples, 90),
+               percentile_us(samples, n_samples, 99), percentile_us(samples, n_samples, 99.9), samples[n_samples - 1] / 1000.0);
+    }
+}
+
+// One line per transaction, times relative to the first transaction started
+static void print_timeline(size_t n_records, int unit)
+{
+    int64_t origin = 0;
+    for (size_t i = 0; i < n_records; i++)
+    {
+        if (selected(&records[i], unit))
+        {
+            origin = records[i].started_ns;
+            break;
+        }
+    }
+
+    printf("%10s %12s %4s %3s %5s %5s %6s", "sequence", "start_ms", "unit", "fc", "addr", "count", "status");
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+    {
+        printf(" %10s", phase_names[phase]);
+    }
+    printf("\n");
+
+    for (size_t i = 0; i < n_records; i++)
+    {
+        const struct serial_modbus_timing* record = &records[i];
+        if (!selected(record, unit))
+        {
+            continue;
+        }
+
+        printf("%10llu %12.3f %4u %3u %5u %5u %6d", (unsigned long long)record->sequence, (record->started_ns - origin) / 1e6,
+               record->slave, record->function, record->address, record->count, record->status);
+        for (int phase = 0; phase < PHASE_COUNT; phase++)
+        {
+            const int64_t ns = phase_ns(record, phase);
+            if (ns < 0)
+            {
+                printf(" %10s", "-");
+            }
+            else
+            {
+                printf(" %10.1f", ns / 1000.0);
+            }
+        }
+        printf("\n");
+    }
+    printf("\n");
+}
+
+int main(int argc, char* argv[])
+{
+    bool timeline = false;
+    int unit = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "htu:")) != -1)
+    {
+        switch (opt)
+        {
+            case 't':
+                timeline = true;
+                break;
+            case 'u':
+                unit = atoi(optarg);
+                break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+
+    const char* path = (optind < argc) ? argv[optind] : DEFAULT_TIMING_FILE;
+    const size_t n_records = read_records(path);
+    if (0 == n_records)
+    {
+        printf("No transaction recorded yet\n");
+        return EXIT_SUCCESS;
+    }
+
+    if (timeline)
+    {
+        print_timeline(n_records, unit);
+    }
+
+    // Gaps in the sequence numbers are transactions the ring already dropped
+    printf("%zu transactions, sequence %llu to %llu\n", n_records, (unsigned long long)records[0].sequence,
+           (unsigned long long)records[n_records - 1].sequence);
+    print_percentiles(n_records, unit);
+
+    return EXIT_SUCCESS;
+}